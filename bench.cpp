@@ -0,0 +1,675 @@
+/**
+ *  bench.cpp
+ *
+ *  Benchmark part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#include "db.hpp"
+#include "match.hpp"
+#include "normalize.hpp"
+#include "print.hpp"
+#include "scan.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <streambuf>
+#include <utility>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+
+#include <boost/cstdint.hpp>
+
+//  Deprecated features not wanted
+#define BOOST_FILESYSTEM_NO_DEPRECATED
+
+#include <boost/filesystem.hpp>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Use a shortcut
+namespace fs = boost::filesystem;
+
+
+// Characters of generated names; searches for anything else find nothing
+static const char NAME_CHARACTERS[] = "abcdefghijklmnopqrstuvwxyz0123456789_-.";
+
+// Names kept for making up queries
+static const size_t SAMPLED_NAMES = 1024;
+
+// Calls per micro benchmark
+static const unsigned long MICRO_ROUNDS = 1000000;
+
+// Name of the disc in the benchmark catalog
+static const char* DISC_NAME = "bench";
+
+
+/*
+ * Shape of a generated tree. Directories get their files and then their
+ * subdirectories, level by level, until the tree has the wanted number
+ * of entries or the deepest level is full.
+ */
+struct Shape
+{
+    unsigned long entries;
+    unsigned int depth;
+    unsigned int fanout;
+    unsigned int files;
+    unsigned int min_name;
+    unsigned int max_name;
+    unsigned long seed;
+    unsigned int queries;
+};
+
+/*
+ * Pseudo random numbers, the same on every machine and in every run
+ * for the same seed (xorshift64*).
+ */
+class Random
+{
+public:
+    Random(boost::uint64_t seed) :
+        state(seed != 0 ? seed : 0x9e3779b97f4a7c15ULL)
+    {
+    }
+    boost::uint64_t next(void)
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+
+        return state * 0x2545f4914f6cdd1dULL;
+    }
+    // Evenly spread in [0, limit)
+    unsigned long below(unsigned long limit)
+    {
+        return static_cast<unsigned long>((next() >> 11) % limit);
+    }
+private:
+    boost::uint64_t state;
+};
+
+/*
+ * Writes a directory tree of the given shape with empty files, and keeps
+ * a sample of the names for the searches.
+ */
+class TreeGenerator
+{
+public:
+    TreeGenerator(const Shape& shape) :
+        shape(shape), random(shape.seed), directories(0), files(0), seen(0)
+    {
+    }
+    void generate(const fs::path& root)
+    {
+        std::vector<std::pair<fs::path, unsigned int> > level;
+        std::vector<std::pair<fs::path, unsigned int> > next_level;
+
+        fs::create_directories(root);
+        directories++;
+
+        level.push_back(std::make_pair(root, 0u));
+
+        while(!level.empty() && count() < shape.entries)
+        {
+            next_level.clear();
+
+            for(size_t i = 0; i < level.size() && count() < shape.entries; i++)
+            {
+                std::set<std::string> names;
+
+                for(unsigned int j = 0; j < shape.files && count() < shape.entries; j++)
+                {
+                    std::string file_name = unique_name(names);
+                    FILE* file = fopen((level[i].first / file_name).string().c_str(), "w");
+
+                    if(file == NULL)
+                        throw(DBError("Could not create " + (level[i].first / file_name).string(), DBError::FILE_ERROR));
+
+                    fclose(file);
+
+                    files++;
+                    sample(file_name);
+                }
+
+                if(level[i].second >= shape.depth)
+                    continue;
+
+                for(unsigned int j = 0; j < shape.fanout && count() < shape.entries; j++)
+                {
+                    fs::path directory = level[i].first / unique_name(names);
+
+                    fs::create_directory(directory);
+                    directories++;
+
+                    next_level.push_back(std::make_pair(directory, level[i].second + 1));
+                }
+            }
+
+            level.swap(next_level);
+        }
+    }
+    unsigned long get_directories(void) const
+    {
+        return directories;
+    }
+    unsigned long get_files(void) const
+    {
+        return files;
+    }
+    const std::vector<std::string>& get_names(void) const
+    {
+        return names_sample;
+    }
+private:
+    unsigned long count(void) const
+    {
+        return directories + files;
+    }
+    std::string name(void)
+    {
+        unsigned int length = shape.min_name + random.below(shape.max_name - shape.min_name + 1);
+
+        std::string generated;
+
+        for(unsigned int i = 0; i < length; i++)
+            generated.push_back(NAME_CHARACTERS[random.below(sizeof(NAME_CHARACTERS) - 1)]);
+
+        // Neither hidden nor special
+        if(generated[0] == '.')
+            generated[0] = 'x';
+
+        return generated;
+    }
+    // Name not yet used in a directory; short names may run out, they get a number then
+    std::string unique_name(std::set<std::string>& used)
+    {
+        std::string generated = name();
+
+        for(int tries = 0; tries < 8 && used.count(generated) > 0; tries++)
+            generated = name();
+
+        if(used.count(generated) > 0)
+        {
+            std::ostringstream numbered;
+            numbered << generated << used.size();
+            generated = numbered.str();
+        }
+
+        used.insert(generated);
+
+        return generated;
+    }
+    // Keep every name until the sample is full, then replace them at random
+    void sample(const std::string& name)
+    {
+        seen++;
+
+        if(names_sample.size() < SAMPLED_NAMES)
+            names_sample.push_back(name);
+        else if(random.below(seen) < SAMPLED_NAMES)
+            names_sample[random.below(SAMPLED_NAMES)] = name;
+    }
+    Shape shape;
+    Random random;
+    unsigned long directories;
+    unsigned long files;
+    unsigned long seen;
+    std::vector<std::string> names_sample;
+};
+
+/*
+ * Output that goes nowhere, so that printing costs what it costs for a
+ * fast consumer.
+ */
+class NullBuffer : public std::streambuf
+{
+protected:
+    int overflow(int c)
+    {
+        return c == EOF ? 0 : c;
+    }
+    std::streamsize xsputn(const char*, std::streamsize count)
+    {
+        return count;
+    }
+};
+
+// Seconds since the given time
+static double
+seconds_since(const boost::posix_time::ptime& start)
+{
+    return (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+}
+
+static boost::posix_time::ptime
+now(void)
+{
+    return boost::posix_time::microsec_clock::universal_time();
+}
+
+// Nearest rank percentile of sorted values
+static double
+percentile(const std::vector<double>& sorted, double rank)
+{
+    if(sorted.empty())
+        return 0;
+
+    // Rounded up, the smallest value that the given share of values does not exceed
+    double position = rank / 100 * sorted.size();
+    size_t index = static_cast<size_t>(position);
+
+    if(index < position)
+        index++;
+
+    return sorted[std::max<size_t>(std::min(index, sorted.size()), 1) - 1];
+}
+
+// JSON object with the latency percentiles of a series, in milliseconds
+static std::string
+latencies(std::vector<double> seconds)
+{
+    std::sort(seconds.begin(), seconds.end());
+
+    double total = 0;
+
+    for(size_t i = 0; i < seconds.size(); i++)
+        total += seconds[i];
+
+    std::ostringstream json;
+    json << "{\"count\": " << seconds.size()
+         << ", \"mean_ms\": " << (seconds.empty() ? 0 : total / seconds.size() * 1e3)
+         << ", \"p50_ms\": " << percentile(seconds, 50) * 1e3
+         << ", \"p90_ms\": " << percentile(seconds, 90) * 1e3
+         << ", \"p99_ms\": " << percentile(seconds, 99) * 1e3
+         << ", \"max_ms\": " << (seconds.empty() ? 0 : seconds.back() * 1e3) << "}";
+
+    return json.str();
+}
+
+// Substrings of sampled names and texts found nowhere, the same for the same seed
+static std::vector<std::string>
+make_queries(const std::vector<std::string>& names, unsigned int count, unsigned long seed)
+{
+    Random random(seed + 1);
+
+    std::vector<std::string> queries;
+
+    for(unsigned int i = 0; i < count && !names.empty(); i++)
+    {
+        // Every tenth query misses
+        if(i % 10 == 9)
+        {
+            queries.push_back("#none#");
+            continue;
+        }
+
+        const std::string& name = names[random.below(names.size())];
+
+        size_t length = std::min<size_t>(name.length(), 3 + random.below(4));
+        size_t start = random.below(name.length() - length + 1);
+
+        queries.push_back(name.substr(start, length));
+    }
+
+    return queries;
+}
+
+// Times searches for each of the texts, or globs if asked to
+static std::vector<double>
+time_searches(DB& db, Print& print, const std::vector<std::string>& texts, bool directories_only, bool glob)
+{
+    std::vector<double> seconds;
+
+    for(size_t i = 0; i < texts.size(); i++)
+    {
+        boost::posix_time::ptime start = now();
+
+        if(glob)
+        {
+            Matcher matcher((texts[i] + "*").c_str(), Matcher::GLOB);
+            db.search_text(texts[i].c_str(), directories_only, 1, &matcher);
+        }
+        else
+        {
+            db.search_text(texts[i].c_str(), directories_only);
+        }
+
+        print.output();
+
+        seconds.push_back(seconds_since(start));
+    }
+
+    return seconds;
+}
+
+// Remove what the benchmark made, a given work directory stays
+static void
+remove_work(const fs::path& work_path, bool given, bool keep)
+{
+    if(keep)
+        return;
+
+    boost::system::error_code error;
+
+    if(given)
+    {
+        fs::remove_all(work_path / "tree", error);
+        fs::remove(work_path / "bench.sqlite", error);
+    }
+    else
+    {
+        fs::remove_all(work_path, error);
+    }
+}
+
+static void
+print_help(void)
+{
+    std::cout << std::endl
+              << "Disc Data Base benchmark" << std::endl
+              << std::endl
+              << "ddb-bench [options]" << std::endl
+              << std::endl
+              << "  Options:" << std::endl
+              << "  -n, --entries N                   Generate N files and directories" << std::endl
+              << "  -d, --depth N                     Nest directories N levels deep" << std::endl
+              << "  -o, --fanout N                    Give each directory N subdirectories" << std::endl
+              << "  -F, --files N                     Give each directory N files" << std::endl
+              << "  -l, --name-length MIN:MAX         Draw name lengths evenly from MIN to MAX" << std::endl
+              << "  -s, --seed N                      Generate the tree and queries from seed N" << std::endl
+              << "  -q, --queries N                   Time N searches of each kind" << std::endl
+              << "  -w, --work directory              Generate into this directory" << std::endl
+              << "  -k, --keep                        Keep the tree and the catalog" << std::endl
+              << "  -h, --help                        Print this help message" << std::endl
+              << std::endl
+              << "Results are printed as JSON." << std::endl
+              << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    Shape shape;
+    shape.entries = 100000;
+    shape.depth = 6;
+    shape.fanout = 4;
+    shape.files = 32;
+    shape.min_name = 4;
+    shape.max_name = 24;
+    shape.seed = 1;
+    shape.queries = 200;
+
+    std::string work;
+    bool keep = false;
+
+    static struct option long_options[] =
+    {
+        {"depth",        required_argument, 0, 'd'},
+        {"entries",      required_argument, 0, 'n'},
+        {"fanout",       required_argument, 0, 'o'},
+        {"files",        required_argument, 0, 'F'},
+        {"help",         no_argument,       0, 'h'},
+        {"keep",         no_argument,       0, 'k'},
+        {"name-length",  required_argument, 0, 'l'},
+        {"queries",      required_argument, 0, 'q'},
+        {"seed",         required_argument, 0, 's'},
+        {"work",         required_argument, 0, 'w'},
+        { 0,             0,                 0,  0 }
+    };
+
+    int ch, option_index;
+
+    while((ch = getopt_long(argc, argv, "d:F:hkl:n:o:q:s:w:", long_options, &option_index)) != -1)
+    {
+        switch(ch)
+        {
+            case 'd':
+                shape.depth = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+
+            case 'F':
+                shape.files = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+
+            case 'h':
+                print_help();
+                return EXIT_SUCCESS;
+
+            case 'k':
+                keep = true;
+                break;
+
+            case 'l':
+                if(sscanf(optarg, "%u:%u", &shape.min_name, &shape.max_name) != 2 ||
+                   shape.min_name == 0 || shape.max_name < shape.min_name)
+                {
+                    print_help();
+                    return EXIT_FAILURE;
+                }
+                break;
+
+            case 'n':
+                shape.entries = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'o':
+                shape.fanout = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+
+            case 'q':
+                shape.queries = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+
+            case 's':
+                shape.seed = strtoul(optarg, NULL, 10);
+                break;
+
+            case 'w':
+                work = optarg;
+                break;
+
+            default:
+                print_help();
+                return EXIT_FAILURE;
+        }
+    }
+
+    fs::path work_path = work.empty() ? fs::temp_directory_path() / fs::unique_path("ddb-bench-%%%%-%%%%") : fs::path(work);
+    fs::path tree_path = work_path / "tree";
+    fs::path catalog_path = work_path / "bench.sqlite";
+
+    NullBuffer null_buffer;
+    std::ostream null_stream(&null_buffer);
+
+    // Results go nowhere, errors to the standard error
+    Print print(Print::CRITICAL, null_stream);
+
+    std::ostringstream json;
+
+    // Never remove what an earlier run kept
+    if(fs::exists(tree_path) || fs::exists(catalog_path))
+    {
+        std::cerr << "Work directory " << work_path.string() << " is in use already" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        TreeGenerator generator(shape);
+
+        boost::posix_time::ptime start = now();
+
+        generator.generate(tree_path);
+
+        double generate_seconds = seconds_since(start);
+
+        unsigned long entries = generator.get_directories() + generator.get_files();
+
+        std::vector<std::string> queries = make_queries(generator.get_names(), shape.queries, shape.seed);
+
+        json << "{\"shape\": {\"entries\": " << shape.entries << ", \"depth\": " << shape.depth
+             << ", \"fanout\": " << shape.fanout << ", \"files\": " << shape.files
+             << ", \"min_name\": " << shape.min_name << ", \"max_name\": " << shape.max_name
+             << ", \"seed\": " << shape.seed << ", \"queries\": " << shape.queries << "}," << std::endl;
+
+        json << " \"tree\": {\"directories\": " << generator.get_directories()
+             << ", \"files\": " << generator.get_files() << ", \"seconds\": " << generate_seconds << "}," << std::endl;
+
+        // Micro benchmarks on the sampled names
+        const std::vector<std::string>& names = generator.get_names();
+
+        if(!names.empty())
+        {
+            Normalizer normalizer;
+            Matcher matcher("*a*b*", Matcher::GLOB);
+
+            unsigned long key_bytes = 0;
+            unsigned long matches = 0;
+
+            start = now();
+
+            for(unsigned long i = 0; i < MICRO_ROUNDS; i++)
+            {
+                const std::string& name = names[i % names.size()];
+                key_bytes += normalizer.key(name.data(), name.length()).length();
+            }
+
+            double key_seconds = seconds_since(start);
+
+            start = now();
+
+            for(unsigned long i = 0; i < MICRO_ROUNDS; i++)
+            {
+                const std::string& name = names[i % names.size()];
+                matches += matcher.matches(name.data(), name.length()) ? 1 : 0;
+            }
+
+            double match_seconds = seconds_since(start);
+
+            // All sampled names NUL separated, scanned again and again
+            std::string buffer;
+
+            for(size_t i = 0; i < names.size(); i++)
+            {
+                buffer.append(names[i]);
+                buffer.push_back('\0');
+            }
+
+            Scanner scanner("#none#", 6);
+
+            unsigned long scanned = 0;
+
+            start = now();
+
+            while(scanned < MICRO_ROUNDS * 16)
+            {
+                if(scanner.find(buffer.data(), 0, buffer.length()) != buffer.length())
+                    break;
+
+                scanned += buffer.length();
+            }
+
+            double scan_seconds = seconds_since(start);
+
+            json << " \"micro\": {\"name_keys_per_s\": " << (unsigned long) (MICRO_ROUNDS / key_seconds)
+                 << ", \"glob_matches_per_s\": " << (unsigned long) (MICRO_ROUNDS / match_seconds)
+                 << ", \"scan_mb_per_s\": " << scanned / scan_seconds / 1e6
+                 << ", \"scan_kernel\": \"" << scanner.get_kernel() << "\""
+                 << ", \"checksum\": " << key_bytes + matches << "}," << std::endl;
+        }
+
+        DB db(&print);
+
+        db.open(catalog_path.string().c_str(), true);
+
+        // Adding the disc, loaded in bulk as the first one
+        start = now();
+
+        db.add_disc(DISC_NAME, tree_path.string().c_str());
+
+        double ingest_seconds = seconds_since(start);
+
+        unsigned long catalog_bytes = fs::file_size(catalog_path);
+
+        // Reading the tree again, with nothing changed
+        start = now();
+
+        db.update_disc(DISC_NAME, tree_path.string().c_str());
+
+        double rescan_seconds = seconds_since(start);
+
+        json << " \"ingest\": {\"seconds\": " << ingest_seconds
+             << ", \"rows_per_s\": " << (unsigned long) (entries / ingest_seconds)
+             << ", \"rescan_seconds\": " << rescan_seconds
+             << ", \"catalog_bytes\": " << catalog_bytes << "}," << std::endl;
+
+        start = now();
+
+        db.list_files(DISC_NAME);
+        print.output();
+
+        double list_seconds = seconds_since(start);
+
+        start = now();
+
+        db.list_files(DISC_NAME, true);
+        print.output();
+
+        double list_directories_seconds = seconds_since(start);
+
+        json << " \"list\": {\"files_per_s\": " << (unsigned long) (generator.get_files() / list_seconds)
+             << ", \"directories_per_s\": " << (unsigned long) (generator.get_directories() / list_directories_seconds)
+             << "}," << std::endl;
+
+        json << " \"search\": {\"files\": " << latencies(time_searches(db, print, queries, false, false))
+             << "," << std::endl << "  \"directories\": " << latencies(time_searches(db, print, queries, true, false))
+             << "," << std::endl << "  \"glob_prefix\": " << latencies(time_searches(db, print, queries, false, true))
+             << "}," << std::endl;
+
+        // The same searches with the substring index
+        start = now();
+
+        db.create_search_index();
+
+        double index_seconds = seconds_since(start);
+
+        unsigned long indexed_bytes = fs::file_size(catalog_path);
+
+        json << " \"indexed\": {\"seconds\": " << index_seconds
+             << ", \"catalog_bytes\": " << indexed_bytes
+             << "," << std::endl << "  \"files\": " << latencies(time_searches(db, print, queries, false, false))
+             << "," << std::endl << "  \"directories\": " << latencies(time_searches(db, print, queries, true, false))
+             << "}}" << std::endl;
+
+        db.close();
+    }
+    catch(std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+
+        remove_work(work_path, !work.empty(), keep);
+
+        return EXIT_FAILURE;
+    }
+
+    remove_work(work_path, !work.empty(), keep);
+
+    std::cout << json.str();
+
+    return EXIT_SUCCESS;
+}
@@ -13,13 +13,27 @@
  */
 
 #include "db.hpp"
-
+#include "explain.hpp"
+#include "hash.hpp"
+#include "match.hpp"
+#include "normalize.hpp"
+#include "snapshot.hpp"
+#include "stats.hpp"
+#include "walk.hpp"
+
+#include <algorithm>
 #include <sstream>
 #include <utility>
 
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
 
 // Use shortcut from example
 #define foreach BOOST_FOREACH
@@ -29,10 +43,312 @@
 
 #include <boost/filesystem.hpp>
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#ifdef _WIN32
+// Keep std::min usable
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
 // Use a shortcut
 namespace fs = boost::filesystem;
 
 
+// Index on files, built only at the end of a bulk load into a catalog without files
+static const char* files_index_definition = "CREATE INDEX IF NOT EXISTS files_index ON files (dir_id, name)";
+
+// Index on names, for names starting with the prefix of a pattern
+static const char* files_name_index_definition = "CREATE INDEX IF NOT EXISTS files_name_index ON files (name)";
+
+// Index on the keys of names, covering searches for them and the listing of their matches
+static const char* files_key_index_definition = "CREATE INDEX IF NOT EXISTS files_key_index ON files (dir_id, name, name_key)";
+
+// Values bound per row of a multi-row insert into files
+static const size_t FILE_COLUMNS = 7;
+
+// Value of PRAGMA auto_vacuum for catalogs vacuumed incrementally
+static const int INCREMENTAL_VACUUM = 2;
+
+// Free pages given back to the file system per step after removing a disc
+static const int VACUUM_STEP_PAGES = 2048;
+
+// Milliseconds to wait for other processes writing to the catalog
+static const int BUSY_TIMEOUT = 60000;
+
+// Index for finding copies of the same contents
+static const char* files_hash_index_definition = "CREATE INDEX IF NOT EXISTS files_hash_index ON files (hash, size) WHERE hash IS NOT NULL";
+
+// Columns added to catalogs since the FAST format
+static const char* added_columns[][3] =
+{
+    {"dirs",  "mtime", "INTEGER"},
+    {"dirs",  "type",  "TEXT"},
+    {"files", "size",  "INTEGER"},
+    {"files", "mtime", "INTEGER"},
+    {"files", "type",  "TEXT"},
+    {"files", "hash",  "INTEGER"},
+    {"dirs",  "name_key", "TEXT"},
+    {"files", "name_key", "TEXT"},
+    {"discs", "dir_count", "INTEGER"},
+    {"discs", "file_count", "INTEGER"}
+};
+
+/*
+ * Name of this host and identifier of this process, recorded with a bulk
+ * load so that others can tell whether its loader is still running.
+ */
+static std::string
+this_host(void)
+{
+    char name[256];
+
+#ifdef _WIN32
+    DWORD length = sizeof(name);
+
+    if(!GetComputerNameA(name, &length))
+        return "";
+#else
+    if(gethostname(name, sizeof(name)) != 0)
+        return "";
+
+    name[sizeof(name) - 1] = '\0';
+#endif
+
+    return name;
+}
+
+static long
+this_process(void)
+{
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return getpid();
+#endif
+}
+
+// Whether the process loading a disc may still run; loaders on other hosts are not known
+static bool
+loader_running(const std::string& host, long process)
+{
+    // Rows of versions not recording their loader
+    if(process == 0)
+        return false;
+
+    if(host != this_host())
+        return true;
+
+#ifdef _WIN32
+    HANDLE handle = OpenProcess(SYNCHRONIZE, FALSE, process);
+
+    if(handle == NULL)
+        return GetLastError() == ERROR_ACCESS_DENIED;
+
+    bool running = (WaitForSingleObject(handle, 0) == WAIT_TIMEOUT);
+
+    CloseHandle(handle);
+
+    return running;
+#else
+    return kill(process, 0) == 0 || errno == EPERM;
+#endif
+}
+
+/*
+ * Condition on a column for the names a search wants, with the
+ * parameters :pattern for LIKE or :low and :high for the range of names
+ * starting with the literal prefix of a matcher.
+ */
+static std::string
+name_condition(const char* column, const Matcher* matcher)
+{
+    std::string condition;
+
+    if(matcher == NULL)
+        return condition + column + " LIKE :pattern";
+
+    if(!matcher->get_prefix().empty())
+        condition = condition + column + ">=:low AND ";
+
+    if(!matcher->get_prefix_end().empty())
+        condition = condition + column + "<:high AND ";
+
+    return condition + "ddb_match(" + column + ")";
+}
+
+static int
+bind_name_condition(sqlite3_stmt* stmt, const std::string& pattern, const Matcher* matcher)
+{
+    int result = SQLITE_OK;
+
+    int pattern_index = sqlite3_bind_parameter_index(stmt, ":pattern");
+    int low_index = sqlite3_bind_parameter_index(stmt, ":low");
+    int high_index = sqlite3_bind_parameter_index(stmt, ":high");
+
+    // Statements are kept, so are the values
+    if(pattern_index > 0)
+        result = sqlite3_bind_text(stmt, pattern_index, pattern.data(), pattern.length(), SQLITE_TRANSIENT);
+
+    if(result == SQLITE_OK && low_index > 0)
+        result = sqlite3_bind_text(stmt, low_index, matcher->get_prefix().data(), matcher->get_prefix().length(), SQLITE_TRANSIENT);
+
+    if(result == SQLITE_OK && high_index > 0)
+        result = sqlite3_bind_text(stmt, high_index, matcher->get_prefix_end().data(), matcher->get_prefix_end().length(), SQLITE_TRANSIENT);
+
+    return result;
+}
+
+// SQL function ddb_match(name), using the matcher of the running search
+static void
+match_function(sqlite3_context* context, int /*argc*/, sqlite3_value** argv)
+{
+    const Matcher* matcher = *static_cast<const Matcher**>(sqlite3_user_data(context));
+
+    const char* text = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+
+    if(matcher == NULL || text == NULL)
+    {
+        sqlite3_result_int(context, 0);
+        return;
+    }
+
+    sqlite3_result_int(context, matcher->matches(text, sqlite3_value_bytes(argv[0])));
+}
+
+// SQL function ddb_key(name), the key of a name for searches ignoring case
+static void
+key_function(sqlite3_context* context, int /*argc*/, sqlite3_value** argv)
+{
+    const Normalizer* normalizer = *static_cast<Normalizer**>(sqlite3_user_data(context));
+
+    const char* text = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+
+    if(normalizer == NULL || text == NULL)
+    {
+        sqlite3_result_null(context);
+        return;
+    }
+
+    std::string key = normalizer->key(text, sqlite3_value_bytes(argv[0]));
+
+    sqlite3_result_text(context, key.data(), key.length(), SQLITE_TRANSIENT);
+}
+
+static int
+create_functions(sqlite3* db, const Matcher** matcher, Normalizer** normalizer)
+{
+    int result =
+    sqlite3_create_function(db, "ddb_match", 1, SQLITE_UTF8, matcher, match_function, NULL, NULL);
+
+    if(result == SQLITE_OK && normalizer != NULL)
+        result = sqlite3_create_function(db, "ddb_key", 1, SQLITE_UTF8, normalizer, key_function, NULL, NULL);
+
+    return result;
+}
+
+// Files with ids from first to last, searched by one thread
+struct SearchPart
+{
+    sqlite3_int64 first;
+    sqlite3_int64 last;
+    const Matcher* matcher;
+    // Directories holding matches and the names of their discs
+    std::vector<std::pair<sqlite3_int64, std::string> > found;
+    bool failed;
+};
+
+/*
+ * Search one part of the files on a connection of its own. Readers do
+ * not block each other, so the parts are searched at the same time.
+ */
+static void
+search_part(std::string filename, std::string query, std::string pattern, SearchPart* part)
+{
+    int result;
+
+    sqlite3* db;
+    sqlite3_stmt* stmt = NULL;
+
+    part->failed = true;
+
+    result =
+    sqlite3_open_v2(filename.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+
+    if(result == SQLITE_OK)
+    {
+        result =
+        create_functions(db, &part->matcher, NULL);
+    }
+
+    if(result == SQLITE_OK)
+    {
+        result =
+        sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, NULL);
+    }
+
+    if(result == SQLITE_OK)
+    {
+        result =
+        bind_name_condition(stmt, pattern, part->matcher);
+
+        sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":first"), part->first);
+        sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":last"), part->last);
+    }
+
+    if(result == SQLITE_OK)
+    {
+        while((result = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            part->found.push_back(std::make_pair(sqlite3_column_int64(stmt, 0),
+                                                 std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)))));
+        }
+
+        part->failed = (result != SQLITE_DONE);
+    }
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+}
+
+/*
+ * Path of the file of a disc in a partitioned catalog, which lies next
+ * to the master catalog.
+ */
+static std::string
+partition_path(sqlite3* db, const std::string& file)
+{
+    return (fs::path(sqlite3_db_filename(db, "main")).parent_path() / file).string();
+}
+
+// Name of the file of a disc in a partitioned catalog, after the master catalog
+static std::string
+partition_file(sqlite3* db, sqlite3_int64 disc_id)
+{
+    std::ostringstream file;
+    file << fs::path(sqlite3_db_filename(db, "main")).filename().string() << ".disc" << disc_id;
+
+    return file.str();
+}
+
+/*
+ * Append a name to a directory path. Paths ending with a separator,
+ * like the root directory, do not get another one.
+ */
+static void
+append_name(std::string& path, const char* name)
+{
+    if(path.empty() || path[path.length()-1] != '/')
+        path.push_back('/');
+
+    path.append(name);
+}
+
+
 DB::DB(Print* print)
 {
     // Store pointer to the printer
@@ -47,23 +363,72 @@ DB::init(void)
 {
     // Reset database pointer
     db = NULL;
+    stats = NULL;
+    explainer = NULL;
+    matcher = NULL;
+    normalizer = NULL;
+    fold_accents = false;
+    partitioned = false;
+
+    // Set insert sizes
+    rows_per_insert = 256;
+    rows_per_commit = 100000;
+    bulk_load = false;
+    metadata = false;
+    hash_contents = false;
+    scan_started = 0;
+
+    // Reset statement cache counters
+    statement_hits = 0;
+    statement_misses = 0;
 
     // Set version
-    version = 1;
+    version = FAST;
+    found_version = UNDEFINED;
 
     // Define database format
-    format.push_back("CREATE TABLE ddb (directory TEXT NOT NULL, file TEXT, disc TEXT NOT NULL)");
-    format.push_back("CREATE INDEX ddb_index ON ddb (directory, file, disc)");
+    format.push_back("CREATE TABLE discs (id INTEGER PRIMARY KEY, name TEXT NOT NULL UNIQUE, "
+                     "dir_count INTEGER, file_count INTEGER)");
+    format.push_back("CREATE TABLE dirs (id INTEGER PRIMARY KEY, disc_id INTEGER NOT NULL, parent_id INTEGER, name TEXT NOT NULL, "
+                     "mtime INTEGER, type TEXT, name_key TEXT)");
+    format.push_back("CREATE INDEX dirs_disc_index ON dirs (disc_id)");
+    format.push_back("CREATE INDEX dirs_parent_index ON dirs (parent_id, name)");
+    format.push_back("CREATE TABLE files (id INTEGER PRIMARY KEY, dir_id INTEGER NOT NULL, name TEXT NOT NULL, "
+                     "size INTEGER, mtime INTEGER, type TEXT, hash INTEGER, name_key TEXT)");
+    format.push_back(files_index_definition);
     format.push_back("CREATE TABLE ddb_version(version INTEGER NOT NULL)");
     std::ostringstream ddb_version_table_contents;
     ddb_version_table_contents << "INSERT INTO ddb_version VALUES (" << version << ")";
     format.push_back(ddb_version_table_contents.str());
+
+    // Define optional substring search index, kept up to date by triggers; catalogs
+    // with name keys index those instead of the names
+    for(int keys = 0; keys < 2; keys++)
+    {
+        std::vector<std::string>& statements = keys ? key_search_index_format : search_index_format;
+        std::string column = keys ? "name_key" : "name";
+
+        statements.push_back("CREATE VIRTUAL TABLE files_search USING fts5(" + column + ", content='files', content_rowid='id', tokenize='trigram')");
+        statements.push_back("CREATE VIRTUAL TABLE dirs_search USING fts5(" + column + ", content='dirs', content_rowid='id', tokenize='trigram')");
+        statements.push_back("CREATE TRIGGER files_search_add AFTER INSERT ON files BEGIN "
+                             "INSERT INTO files_search (rowid, " + column + ") VALUES (new.id, new." + column + "); END");
+        statements.push_back("CREATE TRIGGER files_search_remove AFTER DELETE ON files BEGIN "
+                             "INSERT INTO files_search (files_search, rowid, " + column + ") VALUES ('delete', old.id, old." + column + "); END");
+        statements.push_back("CREATE TRIGGER dirs_search_add AFTER INSERT ON dirs BEGIN "
+                             "INSERT INTO dirs_search (rowid, " + column + ") VALUES (new.id, new." + column + "); END");
+        statements.push_back("CREATE TRIGGER dirs_search_remove AFTER DELETE ON dirs BEGIN "
+                             "INSERT INTO dirs_search (dirs_search, rowid, " + column + ") VALUES ('delete', old.id, old." + column + "); END");
+        statements.push_back("INSERT INTO files_search (files_search) VALUES ('rebuild')");
+        statements.push_back("INSERT INTO dirs_search (dirs_search) VALUES ('rebuild')");
+    }
 }
 
 DB::~DB(void) throw(DBError)
 {
     // Close database
     close();
+
+    delete normalizer;
 }
 
 void
@@ -73,19 +438,59 @@ DB::open(const char* dbname, bool initialize) throw(DBError)
 
     int result;
 
+    int flags = SQLITE_OPEN_READWRITE;
+
     // Assume database is not open already
     assert(db == NULL);
 
     p->msg("Opening database...", Print::VERBOSE);
 
+    // New databases must be created
+    if(initialize)
+        flags |= SQLITE_OPEN_CREATE;
+
     // Open database
     result =
-    sqlite3_open_v2(dbname, &db, SQLITE_OPEN_READWRITE, NULL);
+    sqlite3_open_v2(dbname, &db, flags, NULL);
+
+    if(result != SQLITE_OK)
+        throw(DBError(error_message, DBError::FILE_ERROR));
+
+    result =
+    create_functions(db, &matcher, &normalizer);
 
     if(result != SQLITE_OK)
-        throw(DBError(error_message), DBError::FILE_ERROR);
+        throw(DBError(error_message, DBError::FILE_ERROR));
+
+    // Wait for other writers, like processes adding other discs to a partitioned catalog
+    sqlite3_busy_timeout(db, BUSY_TIMEOUT);
 
     p->msg("Done.", Print::DEBUG);
+
+    if(initialize)
+    {
+        p->msg("Creating tables...", Print::VERBOSE);
+
+        // Only possible before the first table, lets removed discs give back their space
+        execute("PRAGMA auto_vacuum=INCREMENTAL", "Could not initialize database");
+
+        foreach(std::string& statement, format)
+            execute(statement.c_str(), "Could not initialize database");
+
+        if(partitioned)
+            execute("CREATE TABLE ddb_partitions (disc_id INTEGER PRIMARY KEY, file TEXT NOT NULL)", "Could not initialize database");
+
+        found_version = version;
+
+        add_name_keys();
+
+        p->msg("Done.", Print::DEBUG);
+    }
+    else
+    {
+        partitioned = query_int("SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name='ddb_partitions'",
+                                error_message) > 0;
+    }
 }
 
 void
@@ -94,8 +499,32 @@ DB::close(void) throw(DBError)
     std::string error_message = "Could not close database";
     int result;
 
+    // Nothing to do if not open
+    if(db == NULL)
+        return;
+
     p->msg("Closing database...", Print::VERBOSE);
 
+    record_status();
+
+    // Statements would keep the database open
+    std::pair<std::string, sqlite3_stmt*> statement;
+    foreach(statement, statement_cache)
+        sqlite3_finalize(statement.second);
+
+    statement_cache.clear();
+
+    std::ostringstream cache_report;
+    cache_report << "Statement cache: " << statement_hits << " hits, " << statement_misses << " misses";
+
+    p->msg(cache_report.str().c_str(), Print::DEBUG);
+
+    if(stats != NULL)
+    {
+        stats->add_count("statement_cache_hits", statement_hits);
+        stats->add_count("statement_cache_misses", statement_misses);
+    }
+
     // Close database
     result =
     sqlite3_close(db);
@@ -104,13 +533,17 @@ DB::close(void) throw(DBError)
     if(result != SQLITE_OK)
         throw(DBError(error_message, DBError::FILE_ERROR));
 
+    db = NULL;
+
     p->msg("Done.", Print::DEBUG);
 }
 
 bool
 DB::has_correct_format(void) throw(DBError)
 {
+    const char* version_table_check = "SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name='ddb_version'";
     const char* version_check = "SELECT COUNT(*) AS count, version FROM ddb_version";
+    const char* basic_check = "SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name='ddb'";
 
     std::string error_message = "Could not check database correctness";
 
@@ -118,35 +551,50 @@ DB::has_correct_format(void) throw(DBError)
 
     bool format_is_correct = false;
 
+    found_version = UNDEFINED;
+
     // Prepare SQL statement
     sqlite3_stmt* stmt;
 
-    result =
-    sqlite3_prepare_v2(db, version_check, -1, &stmt, NULL);
-
-    if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::PREPARE_STATEMENT));
+    if(query_int(version_table_check, error_message) == 1)
+    {
+        stmt = prepare(version_check, error_message);
 
-    // Execute SQL statement
-    result =
-    sqlite3_step(stmt);
+        // Execute SQL statement
+        result =
+        sqlite3_step(stmt);
 
-    if(result != SQLITE_ROW)
-        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+        if(result != SQLITE_ROW)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
 
-    // Result should have only one row
-    if(sqlite3_column_int(stmt, 0) == 1)
+        // Result should have only one row
+        if(sqlite3_column_int(stmt, 0) == 1)
+            found_version = sqlite3_column_int(stmt, 1);
+    }
+    else
     {
-        // Version in database should be equal to the version of this class
-        format_is_correct = (sqlite3_column_int(stmt, 1) == version);
+        // Databases of the first version lack the version table
+        stmt = prepare(basic_check, error_message);
+
+        result =
+        sqlite3_step(stmt);
+
+        if(result != SQLITE_ROW)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+        if(sqlite3_column_int(stmt, 0) == 1)
+            found_version = BASIC;
     }
 
-    // Finalize SQL statement
+    // Reset SQL statement
     result =
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
 
     if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::FINALIZE_STATEMENT));
+        throw(DBError(error_message, DBError::RESET_STATEMENT));
+
+    // Version in database should be equal to the version of this class
+    format_is_correct = (found_version == version);
 
     if(!format_is_correct)
         p->msg("Database has wrong format!", Print::INFO);
@@ -155,209 +603,337 @@ DB::has_correct_format(void) throw(DBError)
     return format_is_correct;
 }
 
-bool
-DB::is_disc_present(const char* discname) throw(DBError)
+int
+DB::get_version(void)
 {
-    const char* disc_presence_check = "SELECT DISTINCT disc FROM ddb WHERE disc LIKE ?";
+    return found_version;
+}
 
-    int result;
+void
+DB::upgrade(void) throw(DBError)
+{
+    const char* add_disc_entry = "INSERT INTO discs (name) VALUES (?)";
+    const char* add_dir_entry = "INSERT INTO dirs (disc_id, parent_id, name, name_key, mtime, type) VALUES (?, ?, ?, ?, ?, ?)";
+    const char* add_file_entry = "INSERT INTO files (dir_id, name, name_key) VALUES (?, ?, ?)";
+    const char* basic_entries = "SELECT disc, directory, file FROM ddb ORDER BY disc, directory";
 
-    bool disc_present = false;
+    std::string error_message = "Could not upgrade database";
 
-    std::string error_message = "Could not check disc presence";
+    int result;
 
-    // Prepare SQL statement
-    sqlite3_stmt* stmt;
+    // Current databases only gain what was added since they were made
+    if(found_version == version && partitioned)
+    {
+        std::vector<Partition> parts;
 
-    result =
-    sqlite3_prepare_v2(db, disc_presence_check, -1, &stmt, NULL);
+        find_partitions(NULL, parts);
 
-    if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::PREPARE_STATEMENT));
+        for(size_t i = 0; i < parts.size(); i++)
+        {
+            boost::scoped_ptr<DB> partition(open_partition(parts[i].file));
 
-    // Execute SQL statement
-    result =
-    sqlite3_step(stmt);
+            partition->has_correct_format();
+            partition->upgrade();
 
-    // Check whether we have at least one disc in the database
-    if(result == SQLITE_ROW)
-    {
-        disc_present = true;
-    }
-    else if(result == SQLITE_DONE)
-    {
-        disc_present = false;
+            copy_counts(parts[i].disc_id, *partition);
+        }
+
+        return;
     }
-    else
+
+    if(found_version == version)
     {
-        // We got an error
-        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+        add_metadata_columns();
+        count_entries(0);
+
+        if(query_int("PRAGMA auto_vacuum", error_message) != INCREMENTAL_VACUUM)
+        {
+            p->msg("Enabling incremental vacuum...", Print::VERBOSE);
+
+            execute("PRAGMA auto_vacuum=INCREMENTAL", error_message);
+            execute("VACUUM", error_message);
+
+            p->msg("Done.", Print::DEBUG);
+        }
+
+        return;
     }
 
-    // Finalize SQL statement
-    result =
-    sqlite3_finalize(stmt);
+    if(found_version != BASIC)
+        throw(DBError("Database format is unknown, can not upgrade", DBError::WARNING));
 
-    if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::FINALIZE_STATEMENT));
+    p->msg("Upgrading database...", Print::VERBOSE);
 
-    // Return disc presence
-    return disc_present;
-}
+    prepare_normalizer();
 
-void
-DB::add_disc(const char* disc_name, const char* starting_path) throw(DBError)
-{
-    const char* begin_transaction = "BEGIN";
-    const char* add_entry = "INSERT INTO ddb (directory, file, disc) VALUES (?, ?, ?)";
-    const char* end_transaction = "COMMIT";
+    begin_bulk_load();
 
-    std::string error_message = std::string("Could not add disc ") + disc_name;
+    execute("BEGIN", error_message, DBError::BEGIN_TRANSACTION);
 
-    int result;
+    // Create new tables next to the old one, index files when they are all in
+    execute("DROP TABLE IF EXISTS ddb_version", error_message);
 
-    // Declare disc root directory
-    fs::path disc_path(starting_path);
+    foreach(std::string& statement, format)
+        execute(statement.c_str(), error_message);
 
-    // Check, whether disc path is a directory
-    if(!fs::is_directory(disc_path))
-        throw(DBError(std::string("Path ") + starting_path + " is not a directory", DBError::FILE_ERROR));
+    execute("DROP INDEX files_index", error_message);
+
+    // Prepare SQL statements
+    sqlite3_stmt* select_stmt;
+    sqlite3_stmt* disc_stmt;
+    sqlite3_stmt* dir_stmt;
+    sqlite3_stmt* file_stmt;
 
-    // Container of file names
-    std::vector<std::pair<fs::path, bool> > filenames;
+    select_stmt = prepare(basic_entries, error_message);
+    disc_stmt = prepare(add_disc_entry, error_message);
+    dir_stmt = prepare(add_dir_entry, error_message);
+    file_stmt = prepare(add_file_entry, error_message);
 
-    // Open directory and iterate through it recursively
-    fs::path current_path;
-    bool current_path_is_directory;
-    fs::recursive_directory_iterator end;
+    // Copy entries disc by disc
+    std::string current_disc;
+    sqlite3_int64 disc_id = 0;
+    std::map<std::string, sqlite3_int64> ids;
 
-    for(fs::recursive_directory_iterator dir(disc_path);
-        dir != end;
-        dir++)
+    while(true)
     {
-        current_path = dir->path();
-        current_path_is_directory = fs::is_directory(current_path);
+        result =
+        sqlite3_step(select_stmt);
 
-        // Put current file name into vector
-        filenames.push_back(std::make_pair(current_path, current_path_is_directory));
-    }
+        if(result == SQLITE_DONE)
+            break;
+        else if(result != SQLITE_ROW)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
 
-    // Sort filenames
-    sort(filenames.begin(),filenames.end());
+        const char* disc = reinterpret_cast<const char*>(sqlite3_column_text(select_stmt, 0));
+        const char* directory = reinterpret_cast<const char*>(sqlite3_column_text(select_stmt, 1));
+        const char* file = reinterpret_cast<const char*>(sqlite3_column_text(select_stmt, 2));
 
-    // Print file names, if verbosity is set high enough
-    if(p->get_verbosity() >= Print::VERBOSE_DEBUG)
-    {
-        std::pair<fs::path, bool> it;
-        foreach(it, filenames)
+        // Register next disc
+        if(disc_id == 0 || current_disc != disc)
         {
-            std::cout << (it.second ? "Directory" : "File") << " " << it.first << std::endl;
-        }
-    }
+            current_disc = disc;
+            ids.clear();
 
-    // Begin transaction
-    result =
-    sqlite3_exec(db, begin_transaction, NULL, NULL, NULL);
+            sqlite3_reset(disc_stmt);
+            sqlite3_bind_text(disc_stmt, 1, disc, -1, SQLITE_TRANSIENT);
 
-    if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::BEGIN_TRANSACTION));
+            if(sqlite3_step(disc_stmt) != SQLITE_DONE)
+                throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
 
-    // Prepare SQL statement
-    sqlite3_stmt* stmt;
+            disc_id = sqlite3_last_insert_rowid(db);
+        }
 
-    sqlite3_prepare_v2(db, add_entry, -1, &stmt, NULL);
+        sqlite3_int64 dir_id = add_directory(ids, dir_stmt, disc_id, directory, false);
 
-    if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::PREPARE_STATEMENT));
+        // Directories were stored with the file name NULL
+        if(file == NULL || strcmp(file, "NULL") == 0)
+            continue;
 
-    // Bind disc name
-    sqlite3_bind_text(stmt, 3, disc_name, -1, SQLITE_STATIC);
+        sqlite3_reset(file_stmt);
+        sqlite3_bind_int64(file_stmt, 1, dir_id);
+        sqlite3_bind_text(file_stmt, 2, file, -1, SQLITE_STATIC);
 
-    if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::BIND_PARAMETER));
+        std::string key = normalizer->key(file, strlen(file));
+        sqlite3_bind_text(file_stmt, 3, key.data(), key.length(), SQLITE_TRANSIENT);
 
-    p->msg("Inserting files into database...", Print::VERBOSE);
+        if(sqlite3_step(file_stmt) != SQLITE_DONE)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+    }
 
-    // Add files
-    bool file_is_directory;
-    fs::path path;
-    std::string d_entry;
-    std::string f_entry;
+    // Reset SQL statements
+    sqlite3_reset(select_stmt);
+    sqlite3_reset(disc_stmt);
+    sqlite3_reset(dir_stmt);
+    sqlite3_reset(file_stmt);
 
-    std::pair<fs::path, bool> it;
-    foreach(it, filenames)
-    {
-        path = it.first;
-        file_is_directory = it.second;
+    execute(files_index_definition, error_message);
 
-        d_entry = file_is_directory ?
-                    path.generic_string() :
-                    path.parent_path().generic_string();
+    count_entries(0);
 
-        f_entry = file_is_directory ?
-                    "NULL" :
-                    path.filename().generic_string();
+    // Remove the old table
+    execute("DROP TABLE ddb", error_message);
 
-        // Reset SQL statement
-        result =
-        sqlite3_reset(stmt);
+    execute("COMMIT", error_message, DBError::END_TRANSACTION);
 
-        if(result != SQLITE_OK)
-            throw(DBError(error_message, DBError::RESET_STATEMENT));
+    add_name_keys();
 
-        // Bind directory and file
-        result =
-        sqlite3_bind_text(stmt, 1, d_entry.c_str(), -1, SQLITE_STATIC);
+    // Give the space of the old table back
+    execute("PRAGMA auto_vacuum=INCREMENTAL", error_message);
+    execute("VACUUM", error_message);
 
-        if(result != SQLITE_OK)
-            throw(DBError(error_message, DBError::BIND_PARAMETER));
+    end_bulk_load();
 
-        result =
-        sqlite3_bind_text(stmt, 2, f_entry.c_str(), -1, SQLITE_STATIC);
+    found_version = version;
 
-        if(result != SQLITE_OK)
-            throw(DBError(error_message, DBError::BIND_PARAMETER));
+    p->msg("Done.", Print::DEBUG);
+}
 
-        // Execute SQL statement
-        result =
-        sqlite3_step(stmt);
+bool
+DB::has_search_index(void) throw(DBError)
+{
+    const char* index_check = "SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name IN ('files_search', 'dirs_search')";
 
-        // Check for errors
-        if(result != SQLITE_DONE)
-            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
-    }
+    std::string error_message = "Could not check search index";
+
+    int result;
+
+    bool index_present;
+
+    // Prepare SQL statement
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(index_check, error_message);
+
+    // Execute SQL statement
+    result =
+    sqlite3_step(stmt);
+
+    if(result != SQLITE_ROW)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
 
-    // End transaction
+    index_present = (sqlite3_column_int(stmt, 0) == 2);
+
+    // Reset SQL statement
     result =
-    sqlite3_exec(db, end_transaction, NULL, NULL, NULL);
+    sqlite3_reset(stmt);
 
     if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::END_TRANSACTION));
+        throw(DBError(error_message, DBError::RESET_STATEMENT));
+
+    return index_present;
+}
+
+void
+DB::create_search_index(void) throw(DBError)
+{
+    std::string error_message = "Could not create search index";
+
+    // Each disc has its index; the empty one of the master catalog marks discs added later to get one too
+    if(partitioned)
+    {
+        std::vector<Partition> parts;
+
+        find_partitions(NULL, parts);
+
+        for(size_t i = 0; i < parts.size(); i++)
+        {
+            boost::scoped_ptr<DB> partition(open_partition(parts[i].file));
+
+            partition->create_search_index();
+        }
+    }
+
+    // Catalogs indexed before prefixes were searched lack this one
+    execute(files_name_index_definition, error_message);
+
+    if(has_search_index())
+    {
+        p->msg("Search index exists already.", Print::INFO);
+        return;
+    }
+
+    p->msg("Creating search index...", Print::VERBOSE);
+
+    execute("BEGIN", error_message, DBError::BEGIN_TRANSACTION);
+
+    foreach(std::string& statement, has_name_keys() ? key_search_index_format : search_index_format)
+        execute(statement.c_str(), error_message);
+
+    execute("COMMIT", error_message, DBError::END_TRANSACTION);
 
     p->msg("Done.", Print::DEBUG);
 }
 
+bool
+DB::has_name_keys(void) throw(DBError)
+{
+    return query_int("SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name='ddb_name_keys'",
+                     "Could not check name keys") > 0;
+}
+
 void
-DB::remove_disc(const char* disc_name) throw(DBError)
+DB::add_name_keys(void) throw(DBError)
+{
+    std::string error_message = "Could not add name keys";
+
+    if(has_name_keys())
+    {
+        prepare_normalizer();
+        return;
+    }
+
+    // Keys were not there when the search index was made
+    bool search_index = has_search_index();
+
+    add_metadata_columns();
+    prepare_normalizer();
+
+    p->msg("Adding name keys...", Print::VERBOSE);
+
+    execute("BEGIN", error_message, DBError::BEGIN_TRANSACTION);
+
+    // Every name of an older catalog needs its key
+    execute("UPDATE dirs SET name_key=ddb_key(name) WHERE name_key IS NULL", error_message, DBError::EXECUTE_STATEMENT, true);
+    execute("UPDATE files SET name_key=ddb_key(name) WHERE name_key IS NULL", error_message, DBError::EXECUTE_STATEMENT, true);
+    execute(files_key_index_definition, error_message);
+
+    std::ostringstream settings;
+    settings << "INSERT INTO ddb_name_keys VALUES (" << (fold_accents ? 1 : 0) << ")";
+
+    execute("CREATE TABLE ddb_name_keys (fold_accents INTEGER NOT NULL)", error_message);
+    execute(settings.str().c_str(), error_message);
+
+    if(search_index)
+    {
+        const char* triggers[] = { "files_search_add", "files_search_remove", "dirs_search_add", "dirs_search_remove" };
+
+        for(size_t i = 0; i < sizeof(triggers) / sizeof(triggers[0]); i++)
+            execute((std::string("DROP TRIGGER IF EXISTS ") + triggers[i]).c_str(), error_message);
+
+        execute("DROP TABLE files_search", error_message);
+        execute("DROP TABLE dirs_search", error_message);
+
+        foreach(std::string& statement, key_search_index_format)
+            execute(statement.c_str(), error_message);
+    }
+
+    execute("COMMIT", error_message, DBError::END_TRANSACTION);
+
+    p->msg("Done.", Print::DEBUG);
+}
+
+void
+DB::prepare_normalizer(void) throw(DBError)
+{
+    if(normalizer != NULL)
+        return;
+
+    // Keys made before must be made the same way
+    if(has_name_keys())
+        fold_accents = query_int("SELECT fold_accents FROM ddb_name_keys", "Could not read name keys") != 0;
+
+    normalizer = new Normalizer(fold_accents);
+}
+
+bool
+DB::is_disc_present(const char* discname) throw(DBError)
 {
-    const char* remove_query = "DELETE FROM ddb WHERE disc=?";
+    const char* disc_presence_check = "SELECT id FROM discs WHERE name=?";
 
     int result;
 
-    std::string error_message = std::string("Could not remove disc ") + disc_name;
+    bool disc_present = false;
 
-    // Initialize and prepare SQL statement
-    sqlite3_stmt* stmt;
+    std::string error_message = "Could not check disc presence";
 
-    result =
-    sqlite3_prepare_v2(db, remove_query, -1, &stmt, NULL);
+    // Prepare SQL statement
+    sqlite3_stmt* stmt;
 
-    if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::PREPARE_STATEMENT));
+    stmt = prepare(disc_presence_check, error_message);
 
     // Bind disc name
     result =
-    sqlite3_bind_text(stmt, 1, disc_name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 1, discname, -1, SQLITE_STATIC);
 
     if(result != SQLITE_OK)
         throw(DBError(error_message, DBError::BIND_PARAMETER));
@@ -366,86 +942,2717 @@ DB::remove_disc(const char* disc_name) throw(DBError)
     result =
     sqlite3_step(stmt);
 
-    if(result != SQLITE_DONE)
+    // Check whether we have at least one disc in the database
+    if(result == SQLITE_ROW)
+    {
+        disc_present = true;
+    }
+    else if(result == SQLITE_DONE)
+    {
+        disc_present = false;
+    }
+    else
+    {
+        // We got an error
         throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+    }
 
-    // Clean up
+    // Reset SQL statement
     result =
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
 
     if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::FINALIZE_STATEMENT));
+        throw(DBError(error_message, DBError::RESET_STATEMENT));
+
+    // Return disc presence
+    return disc_present;
 }
 
 void
-DB::list_files(const char* disc_name, bool directories_only) throw(DBError)
+DB::add_disc(const char* disc_name, const char* starting_path, unsigned int jobs) throw(DBError)
 {
-    const char* list_files_query = "SELECT directory,file FROM ddb WHERE disc LIKE ?";
-    const char* list_directories_query = "SELECT DISTINCT directory FROM ddb WHERE disc LIKE ?";
+    const char* begin_transaction = "BEGIN";
+    const char* add_disc_entry = "INSERT INTO discs (name) VALUES (?)";
+    const char* add_dir_entry = "INSERT INTO dirs (disc_id, parent_id, name, name_key, mtime, type) VALUES (?, ?, ?, ?, ?, ?)";
+    const char* change_dir_entry = "UPDATE dirs SET mtime=?, type=? WHERE id=?";
+    const char* end_transaction = "COMMIT";
 
-    const char* list_query = directories_only ? list_directories_query : list_files_query;
+    // Number of entries taken from the walker at once
+    const size_t batch_size = 1024;
 
-    std::string error_message = "Could not list " + directories_only ? "directories" : "files";
+    std::string error_message = std::string("Could not add disc ") + disc_name;
 
     int result;
 
-    // Prepare statement
-    sqlite3_stmt* stmt;
+    // Declare disc root directory
+    fs::path disc_path(starting_path);
+
+    // Check, whether disc path is a directory
+    if(!fs::is_directory(disc_path))
+        throw(DBError(std::string("Path ") + starting_path + " is not a directory", DBError::FILE_ERROR));
+
+    if(partitioned)
+    {
+        add_partition(disc_name, starting_path, jobs);
+        return;
+    }
+
+    boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::universal_time();
+
+    add_metadata_columns();
+    add_name_keys();
+    count_entries(0);
+
+    scan_started = time(NULL);
+
+    // The first disc of a catalog is always loaded in bulk
+    bool bulk = bulk_load || !has_discs();
 
+    // Indexes are built at the end only while there are no files to index
+    // yet; rebuilding them for all other discs costs more than keeping them.
+    // The largest rowid is read off the end of the table without scanning it
+    bool defer_index = bulk && query_text("SELECT MAX(rowid) FROM files", error_message).empty();
+
+    if(bulk)
+        begin_bulk_load();
+
+    // Begin transaction
     result =
-    sqlite3_prepare_v2(db, list_query, -1, &stmt, NULL);
+    sqlite3_exec(db, begin_transaction, NULL, NULL, NULL);
 
     if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::PREPARE_STATEMENT));
+        throw(DBError(error_message, DBError::BEGIN_TRANSACTION));
 
-    // Bind disc name
+    // Prepare SQL statements
+    sqlite3_stmt* disc_stmt;
+    sqlite3_stmt* dir_stmt;
+    sqlite3_stmt* change_dir_stmt;
+
+    disc_stmt = prepare(add_disc_entry, error_message);
+
+    dir_stmt = prepare(add_dir_entry, error_message);
+
+    change_dir_stmt = prepare(change_dir_entry, error_message);
+
+    // Register disc
     result =
-    sqlite3_bind_text(stmt, 1, disc_name, -1, SQLITE_STATIC);
+    sqlite3_bind_text(disc_stmt, 1, disc_name, -1, SQLITE_STATIC);
 
     if(result != SQLITE_OK)
         throw(DBError(error_message, DBError::BIND_PARAMETER));
 
-    // Get data
-    const char* directory;
-    const char* file;
+    result =
+    sqlite3_step(disc_stmt);
+
+    if(result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
 
-    while(true)
+    sqlite3_reset(disc_stmt);
+
+    sqlite3_int64 disc_id = sqlite3_last_insert_rowid(db);
+
+    // Remember the disc and its loader until it is complete, then drop the index if it is deferred
+    if(bulk)
+        add_pending(disc_id);
+
+    if(defer_index)
     {
-        // Execute SQL statement
-        result =
-        sqlite3_step(stmt);
+        execute("DROP INDEX IF EXISTS files_index", error_message);
+        execute("DROP INDEX IF EXISTS files_key_index", error_message);
+    }
 
-        // Check whether we have at least one disc in the database
-        if(result == SQLITE_ROW)
+    // Directory identifiers by path, the root is named as the walker names it
+    std::map<std::string, sqlite3_int64> ids;
+
+    add_directory(ids, dir_stmt, disc_id, (disc_path / "x").parent_path().generic_string(), true);
+
+    p->msg("Inserting files into database...", Print::VERBOSE);
+
+    // Walk the disc in a separate thread, insert file names as they come;
+    // when hashing, the files pass the hashing threads on their way
+    EntryQueue queue;
+    EntryQueue walked;
+    Walker walker(disc_path, hash_contents ? walked : queue, jobs);
+    Hasher hasher(walked, queue, jobs);
+    boost::thread_group threads;
+
+    walker.collect_metadata(metadata || hash_contents);
+    threads.create_thread(boost::bind(&Walker::run, &walker));
+
+    if(hash_contents)
+        threads.create_thread(boost::bind(&Hasher::run, &hasher));
+
+    std::vector<Entry> batch;
+    batch.reserve(batch_size);
+
+    // Files waiting for the next multi-row insert
+    std::vector<std::pair<sqlite3_int64, const Entry*> > rows;
+    std::map<size_t, sqlite3_stmt*> insert_statements;
+
+    // The variable limit of SQLite caps the rows of one insert
+    size_t max_rows = std::min(rows_per_insert, (size_t) sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1) / FILE_COLUMNS);
+    rows.reserve(max_rows);
+
+    unsigned long total_rows = ids.size();
+    unsigned long uncommitted_rows = 0;
+    bool committed = false;
+
+    try
+    {
+        while(true)
         {
-            if(directories_only)
+            // Time waiting for the walker apart from time spent inserting
             {
-                directory = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-                p->add_directory(disc_name, directory);
+                Stats::Timer timer(stats, "walk");
+
+                if(queue.pop(batch, batch_size) == 0)
+                    break;
             }
-            else
+
+            Stats::Timer timer(stats, "insert");
+
+            if(stats != NULL)
+                stats->add_count("entries", batch.size());
+
+            foreach(Entry& entry, batch)
             {
-                directory = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-                file = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-                p->add_file(disc_name, directory, file);
+                // Print file names, if verbosity is set high enough
+                if(p->get_verbosity() >= Print::VERBOSE_DEBUG)
+                    std::cout << (entry.is_directory ? "Directory" : "File") << " " << entry.directory << "/" << entry.file << std::endl;
+
+                // Hashing passes directories on in any order, so their
+                // contents may have added them already
+                if(hash_contents && entry.is_directory && ids.count(entry.directory) > 0)
+                {
+                    sqlite3_reset(change_dir_stmt);
+                    bind_metadata(change_dir_stmt, 1, entry);
+                    sqlite3_bind_int64(change_dir_stmt, 3, ids[entry.directory]);
+
+                    if(sqlite3_step(change_dir_stmt) != SQLITE_DONE)
+                        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+                    continue;
+                }
+
+                size_t known_directories = ids.size();
+                sqlite3_int64 dir_id = add_directory(ids, dir_stmt, disc_id, entry.directory, false, entry.is_directory ? &entry : NULL);
+                uncommitted_rows += ids.size() - known_directories;
+
+                // Directories are complete with their own entry
+                if(entry.is_directory)
+                    continue;
+
+                rows.push_back(std::make_pair(dir_id, &entry));
+
+                if(rows.size() >= max_rows)
+                {
+                    uncommitted_rows += rows.size();
+                    insert_files(rows, insert_statements);
+                }
+            }
+
+            // Names in the rows belong to this batch
+            uncommitted_rows += rows.size();
+            insert_files(rows, insert_statements);
+
+            // Keep the journal small on large discs
+            if(rows_per_commit > 0 && uncommitted_rows >= rows_per_commit)
+            {
+                Stats::Timer commit_timer(stats, "commit");
+
+                execute(end_transaction, error_message, DBError::END_TRANSACTION);
+                execute(begin_transaction, error_message, DBError::BEGIN_TRANSACTION);
+
+                total_rows += uncommitted_rows;
+                uncommitted_rows = 0;
+                committed = true;
             }
         }
-        else if(result == SQLITE_DONE)
-        {
-            // No more results
-            break;
-        }
-        else
+    }
+    catch(...)
+    {
+        // Stop the walker and leave the database as it was
+        queue.cancel();
+        walked.cancel();
+        threads.join_all();
+        sqlite3_reset(dir_stmt);
+        sqlite3_reset(change_dir_stmt);
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+
+        if(committed && bulk)
+            abandon_bulk_load(disc_id, disc_name);
+        else if(committed)
+            remove_disc(disc_name);
+
+        if(bulk)
+            end_bulk_load();
+
+        throw;
+    }
+
+    threads.join_all();
+
+    total_rows += uncommitted_rows;
+
+    // Reset SQL statements
+    sqlite3_reset(dir_stmt);
+    sqlite3_reset(change_dir_stmt);
+
+    // Walking the disc failed, so do not keep a partial disc
+    if(queue.failed())
+    {
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+
+        if(committed && bulk)
+            abandon_bulk_load(disc_id, disc_name);
+        else if(committed)
+            remove_disc(disc_name);
+
+        if(bulk)
+            end_bulk_load();
+
+        throw(DBError(error_message + ": " + queue.get_error(), DBError::FILE_ERROR));
+    }
+
+    {
+        Stats::Timer timer(stats, "index");
+
+        // Build the index in one go and forget the pending disc
+        if(defer_index)
         {
-            // We got an error
-            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+            p->msg("Building index...", Print::VERBOSE);
+
+            execute(files_index_definition, error_message);
+            execute(files_key_index_definition, error_message);
         }
+
+        if(bulk)
+            execute("DELETE FROM ddb_pending", error_message);
+
+        if(hash_contents)
+            execute(files_hash_index_definition, error_message);
+
+        count_entries(disc_id);
     }
 
-    // Finalize statement
-    result =
-    sqlite3_finalize(stmt);
+    {
+        Stats::Timer timer(stats, "commit");
 
-    if(result != SQLITE_OK)
-        throw(DBError(error_message, DBError::FINALIZE_STATEMENT));
+        // End transaction
+        result =
+        sqlite3_exec(db, end_transaction, NULL, NULL, NULL);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::END_TRANSACTION));
+
+        if(bulk)
+            end_bulk_load();
+    }
+
+    p->msg("Done.", Print::DEBUG);
+
+    if(stats != NULL)
+        stats->add_count("rows", total_rows);
+
+    // Report insert throughput
+    double seconds = (boost::posix_time::microsec_clock::universal_time() - start_time).total_microseconds() / 1e6;
+
+    std::ostringstream report;
+    report << "Inserted " << total_rows << " rows in " << seconds << " s";
+
+    if(seconds > 0)
+        report << " (" << (unsigned long) (total_rows / seconds) << " rows/s)";
+
+    p->msg(report.str().c_str(), Print::INFO);
+
+    if(hasher.get_failures() > 0)
+    {
+        std::ostringstream failures;
+        failures << hasher.get_failures() << " files could not be read for hashing";
+
+        p->msg(failures.str().c_str(), Print::INFO);
+    }
+}
+
+void
+DB::update_disc(const char* disc_name, const char* starting_path, unsigned int jobs) throw(DBError)
+{
+    const char* find_disc = "SELECT discs.id, dirs.id FROM discs JOIN dirs ON dirs.disc_id=discs.id "
+                            "WHERE discs.name=? AND dirs.parent_id IS NULL";
+    const char* rename_root = "UPDATE dirs SET name=?, name_key=? WHERE id=?";
+    const char* known_dirs = "SELECT id, parent_id, name, mtime, type FROM dirs WHERE disc_id=?";
+
+    // Number of entries taken from the walker at once
+    const size_t batch_size = 1024;
+
+    std::string error_message = std::string("Could not update disc ") + disc_name;
+
+    // Declare disc root directory, named as the walker names it
+    fs::path disc_path(starting_path);
+
+    if(!fs::is_directory(disc_path))
+        throw(DBError(std::string("Path ") + starting_path + " is not a directory", DBError::FILE_ERROR));
+
+    std::string root = (disc_path / "x").parent_path().generic_string();
+
+    if(partitioned)
+    {
+        std::vector<Partition> parts;
+
+        find_partitions(disc_name, parts, true);
+
+        boost::scoped_ptr<DB> partition(open_partition(parts[0].file));
+
+        partition->recover();
+        partition->update_disc(disc_name, starting_path, jobs);
+
+        copy_counts(parts[0].disc_id, *partition);
+
+        return;
+    }
+
+    add_metadata_columns();
+    add_name_keys();
+    count_entries(0);
+
+    scan_started = time(NULL);
+
+    execute("BEGIN", error_message, DBError::BEGIN_TRANSACTION);
+
+    // Find disc and its root directory
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(find_disc, error_message);
+
+    sqlite3_bind_text(stmt, 1, disc_name, -1, SQLITE_STATIC);
+
+    if(sqlite3_step(stmt) != SQLITE_ROW)
+    {
+        sqlite3_reset(stmt);
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        throw(DBError(std::string("Disc ") + disc_name + " is not in the database", DBError::WARNING));
+    }
+
+    Update update;
+    update.disc_id = sqlite3_column_int64(stmt, 0);
+    sqlite3_int64 root_id = sqlite3_column_int64(stmt, 1);
+
+    sqlite3_reset(stmt);
+
+    // The disc may be mounted somewhere else now
+    stmt = prepare(rename_root, error_message);
+    std::string root_key = normalizer->key(root.data(), root.length());
+
+    sqlite3_bind_text(stmt, 1, root.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, root_key.c_str(), -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, root_id);
+
+    if(sqlite3_step(stmt) != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_reset(stmt);
+
+    // Directories with a stored modification time need not be read again
+    std::map<std::string, KnownDirectory> known;
+
+    if(metadata)
+    {
+        std::map<sqlite3_int64, std::string> paths;
+        load_directories(update.disc_id, paths);
+
+        stmt = prepare(known_dirs, error_message);
+
+        sqlite3_bind_int64(stmt, 1, update.disc_id);
+
+        while(sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const unsigned char* type = sqlite3_column_text(stmt, 4);
+
+            // Symbolic links to directories are not walked
+            if(type != NULL && type[0] == 'l')
+                continue;
+
+            if(sqlite3_column_type(stmt, 3) != SQLITE_NULL)
+                known[paths[sqlite3_column_int64(stmt, 0)]].mtime = sqlite3_column_int64(stmt, 3);
+
+            if(sqlite3_column_type(stmt, 1) != SQLITE_NULL)
+                known[paths[sqlite3_column_int64(stmt, 1)]].subdirectories.push_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)));
+        }
+
+        sqlite3_reset(stmt);
+
+        // Directories without a stored time are read in any case
+        std::map<std::string, KnownDirectory>::iterator it = known.begin();
+
+        while(it != known.end())
+        {
+            if(it->second.mtime == -1)
+                known.erase(it++);
+            else
+                ++it;
+        }
+    }
+
+    prepare_update(update);
+    update.ids[root] = root_id;
+
+    p->msg("Comparing disc with database...", Print::VERBOSE);
+
+    // Walk the disc directory by directory
+    EntryQueue queue;
+    Walker walker(fs::path(root), queue, jobs, true);
+    walker.collect_metadata(metadata);
+
+    if(metadata)
+        walker.skip_unchanged(&known);
+
+    boost::thread walking(&Walker::run, &walker);
+
+    std::vector<Entry> batch;
+    batch.reserve(batch_size);
+
+    // Listing of the current directory
+    std::vector<Entry> listing;
+
+    try
+    {
+        while(true)
+        {
+            bool done;
+
+            // Time waiting for the walker apart from time spent comparing
+            {
+                Stats::Timer timer(stats, "walk");
+
+                done = (queue.pop(batch, batch_size) == 0);
+            }
+
+            Stats::Timer timer(stats, "update");
+
+            if(stats != NULL)
+                stats->add_count("entries", batch.size());
+
+            foreach(Entry& entry, batch)
+            {
+                if(!entry.is_listing)
+                {
+                    listing.push_back(entry);
+                    continue;
+                }
+
+                // Next listing begins, so the current one is complete
+                if(!listing.empty())
+                    update_directory(listing, update);
+
+                listing.clear();
+                listing.push_back(entry);
+            }
+
+            if(done)
+                break;
+        }
+
+        if(!listing.empty())
+            update_directory(listing, update);
+    }
+    catch(...)
+    {
+        // Stop the walker and leave the database as it was
+        queue.cancel();
+        walking.join();
+        reset_update(update);
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        throw;
+    }
+
+    walking.join();
+
+    reset_update(update);
+
+    // An incomplete walk would remove everything not seen
+    if(queue.failed())
+    {
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        throw(DBError(error_message + ": " + queue.get_error(), DBError::FILE_ERROR));
+    }
+
+    count_entries(update.disc_id);
+
+    {
+        Stats::Timer timer(stats, "commit");
+
+        execute("COMMIT", error_message, DBError::END_TRANSACTION);
+    }
+
+    if(stats != NULL)
+    {
+        stats->add_count("added", update.added);
+        stats->add_count("changed", update.changed);
+        stats->add_count("removed", update.removed);
+    }
+
+    std::ostringstream report;
+    report << "Added " << update.added << ", changed " << update.changed
+           << " and removed " << update.removed << " entries";
+
+    if(metadata)
+        report << ", skipped " << update.skipped << " unchanged directories";
+
+    p->msg(report.str().c_str(), Print::INFO);
+}
+
+void
+DB::set_metadata(bool metadata)
+{
+    this->metadata = metadata;
+}
+
+void
+DB::set_hashing(bool hash_contents)
+{
+    this->hash_contents = hash_contents;
+}
+
+void
+DB::set_bulk_load(bool bulk_load)
+{
+    this->bulk_load = bulk_load;
+}
+
+void
+DB::set_fold_accents(bool fold_accents)
+{
+    this->fold_accents = fold_accents;
+}
+
+void
+DB::set_partitioned(bool partitioned)
+{
+    this->partitioned = partitioned;
+}
+
+void
+DB::set_printer(Print* print)
+{
+    p = print;
+}
+
+void
+DB::set_stats(Stats* stats)
+{
+    this->stats = stats;
+}
+
+void
+DB::set_explainer(Explainer* explainer)
+{
+    this->explainer = explainer;
+}
+
+void
+DB::map_into_memory(void) throw(DBError)
+{
+    // Let the pages of the file be read straight from the page cache
+    execute("PRAGMA mmap_size=2147418112", "Could not map database into memory");
+}
+
+void
+DB::copy_into_memory(void) throw(DBError)
+{
+    std::string error_message = "Could not copy database into memory";
+
+    int result;
+
+    sqlite3* memory_db;
+
+    p->msg("Copying database into memory...", Print::VERBOSE);
+
+    result =
+    sqlite3_open(":memory:", &memory_db);
+
+    if(result != SQLITE_OK)
+    {
+        sqlite3_close(memory_db);
+        throw(DBError(error_message, DBError::FILE_ERROR));
+    }
+
+    result =
+    create_functions(memory_db, &matcher, &normalizer);
+
+    sqlite3_backup* backup = result == SQLITE_OK ? sqlite3_backup_init(memory_db, "main", db, "main") : NULL;
+
+    if(backup == NULL)
+    {
+        sqlite3_close(memory_db);
+        throw(DBError(error_message, DBError::FILE_ERROR));
+    }
+
+    sqlite3_backup_step(backup, -1);
+
+    result =
+    sqlite3_backup_finish(backup);
+
+    if(result != SQLITE_OK)
+    {
+        sqlite3_close(memory_db);
+        throw(DBError(error_message, DBError::FILE_ERROR));
+    }
+
+    record_status();
+
+    // Statements belong to the file, which is not needed any more
+    std::pair<std::string, sqlite3_stmt*> statement;
+    foreach(statement, statement_cache)
+        sqlite3_finalize(statement.second);
+
+    statement_cache.clear();
+
+    sqlite3_close(db);
+    db = memory_db;
+
+    p->msg("Done.", Print::DEBUG);
+}
+
+void
+DB::recover(void) throw(DBError)
+{
+    const char* pending_check = "SELECT COUNT(*) FROM sqlite_master WHERE type='table' AND name='ddb_pending'";
+    const char* pending_discs = "SELECT ddb_pending.disc_id, discs.name, ddb_pending.host, ddb_pending.pid "
+                                "FROM ddb_pending JOIN discs ON discs.id=ddb_pending.disc_id";
+
+    std::string error_message = "Could not recover from interrupted bulk load";
+
+    int result;
+
+    // Nothing was ever loaded in bulk
+    if(query_int(pending_check, error_message) == 0)
+        return;
+
+    add_pending_owner();
+
+    // Hold the write lock, so that no loader finishes or starts in between
+    execute("BEGIN IMMEDIATE", error_message, DBError::BEGIN_TRANSACTION);
+
+    bool recovered = false;
+
+    try
+    {
+        // Collect discs whose loader is gone
+        std::vector<std::pair<sqlite3_int64, std::string> > discs;
+
+        sqlite3_stmt* stmt;
+
+        stmt = prepare(pending_discs, error_message);
+
+        while((result = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            const char* host = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+
+            if(loader_running(host != NULL ? host : "", (long) sqlite3_column_int64(stmt, 3)))
+                continue;
+
+            discs.push_back(std::make_pair(sqlite3_column_int64(stmt, 0),
+                                           std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)))));
+        }
+
+        if(result != SQLITE_DONE)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+        sqlite3_reset(stmt);
+
+        if(!discs.empty())
+        {
+            p->msg("Recovering from interrupted bulk load...", Print::INFO);
+
+            for(size_t i = 0; i < discs.size(); i++)
+                remove_pending(discs[i].first, discs[i].second.c_str());
+
+            recovered = true;
+        }
+
+        execute("COMMIT", error_message, DBError::END_TRANSACTION);
+    }
+    catch(...)
+    {
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        throw;
+    }
+
+    if(recovered)
+    {
+        release_free_pages();
+
+        p->msg("Done.", Print::DEBUG);
+    }
+}
+
+/*
+ * Remove the disc of a failed bulk load of this process, which
+ * committed some of its files already.
+ */
+void
+DB::abandon_bulk_load(sqlite3_int64 disc_id, const char* disc_name) throw(DBError)
+{
+    std::string error_message = std::string("Could not remove disc ") + disc_name;
+
+    execute("BEGIN IMMEDIATE", error_message, DBError::BEGIN_TRANSACTION);
+
+    try
+    {
+        remove_pending(disc_id, disc_name);
+
+        execute("COMMIT", error_message, DBError::END_TRANSACTION);
+    }
+    catch(...)
+    {
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        throw;
+    }
+
+    release_free_pages();
+}
+
+void
+DB::add_pending(sqlite3_int64 disc_id) throw(DBError)
+{
+    const char* pending_disc = "INSERT INTO ddb_pending (disc_id, host, pid) VALUES (?, ?, ?)";
+
+    std::string error_message = "Could not record bulk load";
+
+    int result;
+
+    execute("CREATE TABLE IF NOT EXISTS ddb_pending (disc_id INTEGER NOT NULL, host TEXT, pid INTEGER)", error_message);
+
+    add_pending_owner();
+
+    std::string host = this_host();
+
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(pending_disc, error_message);
+
+    result =
+    sqlite3_bind_int64(stmt, 1, disc_id);
+
+    if(result == SQLITE_OK)
+        result = sqlite3_bind_text(stmt, 2, host.c_str(), -1, SQLITE_TRANSIENT);
+
+    if(result == SQLITE_OK)
+        result = sqlite3_bind_int64(stmt, 3, this_process());
+
+    if(result != SQLITE_OK)
+        throw(DBError(error_message, DBError::BIND_PARAMETER));
+
+    result =
+    sqlite3_step(stmt);
+
+    sqlite3_reset(stmt);
+
+    if(result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+}
+
+// Catalogs of versions before recording the loader lack its columns
+void
+DB::add_pending_owner(void) throw(DBError)
+{
+    std::string error_message = "Could not record bulk load";
+
+    if(has_column("ddb_pending", "pid"))
+        return;
+
+    execute("ALTER TABLE ddb_pending ADD COLUMN host TEXT", error_message);
+    execute("ALTER TABLE ddb_pending ADD COLUMN pid INTEGER", error_message);
+}
+
+// Within a transaction, remove a disc whose bulk load did not finish
+void
+DB::remove_pending(sqlite3_int64 disc_id, const char* disc_name) throw(DBError)
+{
+    std::string error_message = "Could not recover from interrupted bulk load";
+
+    // Index first, so that removing the partial disc is fast
+    execute(files_index_definition, error_message);
+
+    if(has_name_keys())
+        execute(files_key_index_definition, error_message);
+
+    delete_disc(disc_name);
+
+    std::ostringstream forget_disc;
+    forget_disc << "DELETE FROM ddb_pending WHERE disc_id=" << disc_id;
+
+    execute(forget_disc.str().c_str(), error_message);
+
+    // Discs of a partitioned catalog are pending while their file is loaded
+    if(partitioned)
+        delete_partition_file(partition_path(db, partition_file(db, disc_id)));
+}
+
+void
+DB::set_insert_sizes(size_t rows_per_insert, size_t rows_per_commit)
+{
+    this->rows_per_insert = rows_per_insert > 0 ? rows_per_insert : 1;
+    this->rows_per_commit = rows_per_commit;
+}
+
+void
+DB::remove_disc(const char* disc_name) throw(DBError)
+{
+    std::string error_message = std::string("Could not remove disc ") + disc_name;
+
+    if(partitioned)
+    {
+        remove_partition(disc_name);
+        return;
+    }
+
+    execute("BEGIN", error_message, DBError::BEGIN_TRANSACTION);
+
+    delete_disc(disc_name);
+
+    execute("COMMIT", error_message, DBError::END_TRANSACTION);
+
+    release_free_pages();
+}
+
+// Within a transaction, delete the files, directories and entry of a disc
+void
+DB::delete_disc(const char* disc_name) throw(DBError)
+{
+    const char* remove_files = "DELETE FROM files WHERE dir_id IN "
+                               "(SELECT dirs.id FROM discs JOIN dirs ON dirs.disc_id=discs.id WHERE discs.name=?)";
+    const char* remove_dirs = "DELETE FROM dirs WHERE disc_id IN (SELECT id FROM discs WHERE name=?)";
+    const char* remove_disc = "DELETE FROM discs WHERE name=?";
+
+    const char* remove_queries[] = { remove_files, remove_dirs, remove_disc };
+
+    int result;
+
+    std::string error_message = std::string("Could not remove disc ") + disc_name;
+
+    // Files first, then directories, then the disc itself
+    foreach(const char* remove_query, remove_queries)
+    {
+        // Initialize and prepare SQL statement
+        sqlite3_stmt* stmt;
+
+        stmt = prepare(remove_query, error_message);
+
+        // Bind disc name
+        result =
+        sqlite3_bind_text(stmt, 1, disc_name, -1, SQLITE_STATIC);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::BIND_PARAMETER));
+
+        // Execute SQL statement
+        result =
+        sqlite3_step(stmt);
+
+        if(result != SQLITE_DONE)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+        // Clean up
+        result =
+        sqlite3_reset(stmt);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::RESET_STATEMENT));
+    }
+}
+
+/*
+ * Give the pages freed by removing a disc back to the file system, a
+ * bounded number per transaction, if the catalog vacuums incrementally.
+ */
+void
+DB::release_free_pages(void) throw(DBError)
+{
+    std::string error_message = "Could not release free pages";
+
+    if(query_int("PRAGMA auto_vacuum", error_message) != INCREMENTAL_VACUUM)
+        return;
+
+    std::ostringstream vacuum_step;
+    vacuum_step << "PRAGMA incremental_vacuum(" << VACUUM_STEP_PAGES << ")";
+
+    int free_pages = query_int("PRAGMA freelist_count", error_message);
+
+    if(free_pages > 0)
+        p->msg("Releasing free pages...", Print::VERBOSE);
+
+    while(free_pages > 0)
+    {
+        execute(vacuum_step.str().c_str(), error_message);
+
+        // Stop when nothing moves, other connections may hold pages
+        int remaining = query_int("PRAGMA freelist_count", error_message);
+
+        if(remaining >= free_pages)
+            break;
+
+        free_pages = remaining;
+    }
+
+    p->msg("Done.", Print::DEBUG);
+}
+
+void
+DB::list_discs(void) throw(DBError)
+{
+    const char* list_query = "SELECT name, dir_count, file_count FROM discs ORDER BY name";
+    const char* list_names_query = "SELECT name, NULL, NULL FROM discs ORDER BY name";
+    // Discs of a partitioned catalog being added have no file yet
+    const char* list_partitions_query = "SELECT name, dir_count, file_count FROM discs "
+                                        "WHERE id IN (SELECT disc_id FROM ddb_partitions) ORDER BY name";
+
+    std::string error_message = "Could not list discs";
+
+    int result;
+
+    // Prepare statement, catalogs made before discs were counted list names only
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(partitioned ? list_partitions_query :
+                   has_column("discs", "file_count") ? list_query : list_names_query, error_message);
+
+    bool more = true;
+
+    while(more)
+    {
+        // Execute SQL statement
+        result =
+        sqlite3_step(stmt);
+
+        if(result == SQLITE_ROW)
+        {
+            const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            size_t name_length = sqlite3_column_bytes(stmt, 0);
+
+            if(sqlite3_column_type(stmt, 2) == SQLITE_NULL)
+                more = p->add_disc(name, name_length);
+            else
+                more = p->add_disc(name, name_length,
+                                   static_cast<unsigned long>(sqlite3_column_int64(stmt, 2)),
+                                   static_cast<unsigned long>(sqlite3_column_int64(stmt, 1)));
+        }
+        else if(result == SQLITE_DONE)
+        {
+            // No more results
+            break;
+        }
+        else
+        {
+            // We got an error
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+        }
+    }
+
+    // Reset statement
+    result =
+    sqlite3_reset(stmt);
+
+    if(result != SQLITE_OK)
+        throw(DBError(error_message, DBError::RESET_STATEMENT));
+}
+
+void
+DB::list_files(const char* disc_name, bool directories_only) throw(DBError)
+{
+    const char* matching_discs_query = "SELECT id, name FROM discs WHERE name LIKE ? ORDER BY name";
+
+    std::string error_message = std::string("Could not list ") + (directories_only ? "directories" : "files");
+
+    int result;
+
+    // Only the files of the matching discs are opened
+    if(partitioned)
+    {
+        std::vector<Partition> parts;
+
+        find_partitions(disc_name, parts);
+
+        for(size_t i = 0; i < parts.size() && p->wants_more(); i++)
+        {
+            boost::scoped_ptr<DB> partition(open_partition(parts[i].file));
+
+            partition->list_files(parts[i].name.c_str(), directories_only);
+        }
+
+        return;
+    }
+
+    // Find discs matching the given name
+    std::vector<std::pair<sqlite3_int64, std::string> > discs;
+
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(matching_discs_query, error_message);
+
+    // Bind disc name
+    result =
+    sqlite3_bind_text(stmt, 1, disc_name, -1, SQLITE_STATIC);
+
+    if(result != SQLITE_OK)
+        throw(DBError(error_message, DBError::BIND_PARAMETER));
+
+    while((result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        discs.push_back(std::make_pair(sqlite3_column_int64(stmt, 0),
+                                       std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)))));
+    }
+
+    if(result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_reset(stmt);
+
+    bool more = true;
+
+    std::pair<sqlite3_int64, std::string> disc;
+    foreach(disc, discs)
+    {
+        std::vector<std::pair<std::string, sqlite3_int64> > directories;
+
+        {
+            Stats::Timer timer(stats, "paths");
+
+            sorted_directories(disc.first, directories);
+        }
+
+        Stats::Timer timer(stats, "list");
+
+        stmt = directories_only ? NULL : prepare_listing(NULL);
+
+        for(size_t i = 0; more && i < directories.size(); i++)
+        {
+            if(directories_only)
+                more = p->add_directory(disc.second.data(), disc.second.length(),
+                                        directories[i].first.data(), directories[i].first.length());
+            else
+                more = list_directory(stmt, disc.second, directories[i].first, directories[i].second);
+        }
+
+        if(!more)
+            break;
+    }
+}
+
+void
+DB::search_text(const char* text, bool directories_only, unsigned int jobs, const Matcher* matcher) throw(DBError)
+{
+    // Discs come in the order of their names, so their results stay in order
+    if(partitioned)
+    {
+        std::vector<Partition> parts;
+
+        find_partitions(NULL, parts);
+
+        for(size_t i = 0; i < parts.size() && p->wants_more(); i++)
+        {
+            boost::scoped_ptr<DB> partition(open_partition(parts[i].file));
+
+            partition->search_text(text, directories_only, jobs, matcher);
+        }
+
+        return;
+    }
+
+    // Texts are compared with the keys of the names, if the catalog has them
+    bool keys = matcher == NULL && has_name_keys();
+
+    std::string column = keys ? "name_key" : "name";
+
+    // Directories holding matches; their files are listed one directory after another
+    std::string search_files_query =
+        "SELECT DISTINCT dirs.id, discs.name FROM files "
+        "JOIN dirs ON dirs.id=files.dir_id JOIN discs ON discs.id=dirs.disc_id "
+        "WHERE " + name_condition(("files." + column).c_str(), matcher);
+    // Paths of keys are built next to the paths
+    std::string search_directories_query =
+        "WITH RECURSIVE paths(id, disc_id, path, key) AS "
+        "(SELECT id, disc_id, name, " + std::string(keys ? "name_key" : "NULL") + " FROM dirs WHERE parent_id IS NULL "
+        "UNION ALL "
+        "SELECT dirs.id, dirs.disc_id, "
+        "CASE WHEN substr(paths.path, -1)='/' THEN paths.path || dirs.name ELSE paths.path || '/' || dirs.name END, " +
+        std::string(keys ? "CASE WHEN substr(paths.key, -1)='/' THEN paths.key || dirs.name_key ELSE paths.key || '/' || dirs.name_key END " : "NULL ") +
+        "FROM dirs JOIN paths ON dirs.parent_id=paths.id) "
+        "SELECT discs.name, paths.path FROM paths JOIN discs ON discs.id=paths.disc_id "
+        "WHERE " + name_condition(keys ? "paths.key" : "paths.path", matcher) + " ORDER BY discs.name, paths.path";
+    std::string indexed_search_files_query =
+        "SELECT DISTINCT dirs.id, discs.name FROM files_search "
+        "JOIN files ON files.id=files_search.rowid JOIN dirs ON dirs.id=files.dir_id JOIN discs ON discs.id=dirs.disc_id "
+        "WHERE files_search." + column + " LIKE :pattern";
+    // A path contains a text without separators if one of its directory names does
+    std::string indexed_search_directories_query =
+        "WITH RECURSIVE matches(id) AS "
+        "(SELECT rowid FROM dirs_search WHERE " + column + " LIKE :pattern "
+        "UNION "
+        "SELECT dirs.id FROM dirs JOIN matches ON dirs.parent_id=matches.id) "
+        "SELECT matches.id, discs.name FROM matches JOIN dirs ON dirs.id=matches.id JOIN discs ON discs.id=dirs.disc_id";
+
+    // Use the search index, if there is one and the text allows it
+    bool use_index = matcher == NULL && has_search_index() &&
+                     (!directories_only || strpbrk(text, "/_") == NULL);
+
+    std::string error_message = "Could not search";
+
+    int result;
+
+    sqlite3_stmt* stmt;
+
+    if(keys)
+        prepare_normalizer();
+
+    // Create query with wildcards
+    std::string wildcard = "%" + (keys ? normalizer->key(text, strlen(text)) : std::string(text)) + "%";
+
+    // Functions in the queries use the pattern of this search
+    this->matcher = matcher;
+
+    bool more = true;
+
+    if(directories_only && !use_index)
+    {
+        Stats::Timer timer(stats, "query");
+
+        // Paths come sorted from the query
+        stmt = prepare(search_directories_query.c_str(), error_message);
+
+        result =
+        bind_name_condition(stmt, wildcard, matcher);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::BIND_PARAMETER));
+
+        while(more && (result = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            more = p->add_directory(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                                    sqlite3_column_bytes(stmt, 0),
+                                    reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                                    sqlite3_column_bytes(stmt, 1));
+        }
+
+        if(more && result != SQLITE_DONE)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+        sqlite3_reset(stmt);
+    }
+    else
+    {
+        // Directories are few compared to the files, order them by disc and path
+        const char* search_query = directories_only ? indexed_search_directories_query.c_str() :
+                                   use_index ? indexed_search_files_query.c_str() : search_files_query.c_str();
+
+        // Without the search index only the prefix of a pattern, with the index on names, spares reading all files
+        bool full_scan = !use_index && (matcher == NULL || matcher->get_prefix().empty() || !has_search_index());
+
+        stmt = prepare(search_query, error_message, full_scan);
+
+        result =
+        bind_name_condition(stmt, wildcard, matcher);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::BIND_PARAMETER));
+
+        std::vector<std::pair<sqlite3_int64, std::string> > found;
+
+        {
+            Stats::Timer timer(stats, "query");
+
+            // Scanning all files takes long enough to share it among threads; a prefix needs no scan
+            bool parallel = !directories_only && !use_index && jobs > 1 &&
+                            (matcher == NULL || matcher->get_prefix().empty()) &&
+                            search_in_parallel(search_files_query, wildcard, jobs, found);
+
+            if(!parallel)
+            {
+                while((result = sqlite3_step(stmt)) == SQLITE_ROW)
+                {
+                    found.push_back(std::make_pair(sqlite3_column_int64(stmt, 0),
+                                                   std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)))));
+                }
+
+                if(result != SQLITE_DONE)
+                    throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+            }
+
+            sqlite3_reset(stmt);
+        }
+
+        if(stats != NULL)
+            stats->add_count("directories", found.size());
+
+        std::map<sqlite3_int64, std::string> paths;
+        std::vector<std::pair<std::pair<std::string, std::string>, sqlite3_int64> > directories;
+
+        {
+            Stats::Timer timer(stats, "paths");
+
+            std::pair<sqlite3_int64, std::string> directory;
+            foreach(directory, found)
+            {
+                directories.push_back(std::make_pair(std::make_pair(directory.second, directory_path(directory.first, paths)),
+                                                     directory.first));
+            }
+        }
+
+        {
+            Stats::Timer timer(stats, "sort");
+
+            std::sort(directories.begin(), directories.end());
+        }
+
+        Stats::Timer timer(stats, "list");
+
+        stmt = directories_only ? NULL : prepare_listing(wildcard.c_str(), matcher, keys);
+
+        for(size_t i = 0; more && i < directories.size(); i++)
+        {
+            const std::string& disc = directories[i].first.first;
+            const std::string& path = directories[i].first.second;
+
+            if(directories_only)
+                more = p->add_directory(disc.data(), disc.length(), path.data(), path.length());
+            else
+                more = list_directory(stmt, disc, path, directories[i].second);
+        }
+    }
+
+    this->matcher = NULL;
+}
+
+bool
+DB::search_in_parallel(const std::string& query, const std::string& pattern, unsigned int jobs, std::vector<std::pair<sqlite3_int64, std::string> >& found) throw(DBError)
+{
+    std::string error_message = "Could not search";
+
+    const char* filename = sqlite3_db_filename(db, "main");
+
+    sqlite3_stmt* stmt;
+
+    // Other connections do not see a database in memory
+    if(filename == NULL || filename[0] == '\0')
+        return false;
+
+    // Each on its own, both together would read all ids
+    stmt = prepare("SELECT (SELECT min(id) FROM files), (SELECT max(id) FROM files)", error_message);
+
+    if(sqlite3_step(stmt) != SQLITE_ROW)
+    {
+        sqlite3_reset(stmt);
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+    }
+
+    sqlite3_int64 first = sqlite3_column_int64(stmt, 0);
+    sqlite3_int64 last = sqlite3_column_int64(stmt, 1);
+    bool empty = (sqlite3_column_type(stmt, 0) == SQLITE_NULL);
+
+    sqlite3_reset(stmt);
+
+    if(empty)
+        return true;
+
+    // Split the ids into ranges of about the same size
+    sqlite3_int64 range = (last - first) / jobs + 1;
+
+    std::vector<SearchPart> parts(jobs);
+
+    for(unsigned int i = 0; i < jobs; i++)
+    {
+        parts[i].first = first + i * range;
+        parts[i].last = parts[i].first + range - 1;
+        parts[i].matcher = matcher;
+    }
+
+    std::ostringstream report;
+    report << "Searching " << jobs << " ranges of file ids in parallel...";
+
+    p->msg(report.str().c_str(), Print::DEBUG);
+
+    std::string part_query = query + " AND files.id BETWEEN :first AND :last";
+
+    boost::thread_group workers;
+
+    for(unsigned int i = 0; i < jobs; i++)
+        workers.add_thread(new boost::thread(search_part, std::string(filename), part_query, pattern, &parts[i]));
+
+    workers.join_all();
+
+    // A directory may hold matches in more than one range
+    foreach(SearchPart& part, parts)
+    {
+        if(part.failed)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+        found.insert(found.end(), part.found.begin(), part.found.end());
+    }
+
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+
+    return true;
+}
+
+void
+DB::find_duplicates(void) throw(DBError)
+{
+    // Same contents on more than one disc; empty files are all alike
+    const char* duplicates_query = "WITH copies(hash, size) AS "
+                                   "(SELECT files.hash, files.size FROM files JOIN dirs ON dirs.id=files.dir_id "
+                                   "WHERE files.hash IS NOT NULL AND files.size > 0 "
+                                   "GROUP BY files.hash, files.size HAVING COUNT(DISTINCT dirs.disc_id) > 1) "
+                                   "SELECT discs.name, files.dir_id, files.name, files.hash, files.size FROM copies "
+                                   "JOIN files ON files.hash=copies.hash AND files.size=copies.size "
+                                   "JOIN dirs ON dirs.id=files.dir_id JOIN discs ON discs.id=dirs.disc_id "
+                                   // Digests are printed unsigned, negative ones come last
+                                   "ORDER BY copies.hash < 0, copies.hash, copies.size, discs.name, files.dir_id, files.name";
+
+    std::string error_message = "Could not find duplicates";
+
+    int result;
+
+    if(partitioned)
+    {
+        find_partitioned_duplicates();
+        return;
+    }
+
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(duplicates_query, error_message);
+
+    std::map<sqlite3_int64, std::string> paths;
+
+    bool more = true;
+
+    while(more && (result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        // Copies are grouped by digest and size
+        char group[40];
+        int group_length = snprintf(group, sizeof(group), "%016llx %lld",
+                                    (unsigned long long) sqlite3_column_int64(stmt, 3),
+                                    (long long) sqlite3_column_int64(stmt, 4));
+
+        const std::string& directory = directory_path(sqlite3_column_int64(stmt, 1), paths);
+
+        more = p->add_duplicate(group, group_length,
+                                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                                sqlite3_column_bytes(stmt, 0),
+                                directory.data(), directory.length(),
+                                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)),
+                                sqlite3_column_bytes(stmt, 2));
+    }
+
+    if(more && result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_reset(stmt);
+}
+
+void
+DB::export_snapshot(const char* filename) throw(DBError)
+{
+    const char* discs_query = "SELECT id, name FROM discs ORDER BY name";
+
+    std::string error_message = "Could not export snapshot";
+
+    int result;
+
+    p->msg("Exporting snapshot...", Print::VERBOSE);
+
+    std::vector<std::pair<sqlite3_int64, std::string> > discs;
+
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(discs_query, error_message);
+
+    while((result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        discs.push_back(std::make_pair(sqlite3_column_int64(stmt, 0),
+                                       std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)))));
+    }
+
+    if(result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_reset(stmt);
+
+    SnapshotWriter writer;
+
+    if(partitioned)
+    {
+        std::vector<Partition> parts;
+
+        find_partitions(NULL, parts);
+
+        for(size_t i = 0; i < parts.size(); i++)
+        {
+            boost::scoped_ptr<DB> partition(open_partition(parts[i].file));
+
+            writer.add_disc(parts[i].name.data(), parts[i].name.length());
+
+            partition->export_disc(writer, partition->query_int("SELECT id FROM discs", error_message));
+        }
+    }
+    else
+    {
+        std::pair<sqlite3_int64, std::string> disc;
+        foreach(disc, discs)
+        {
+            writer.add_disc(disc.second.data(), disc.second.length());
+
+            export_disc(writer, disc.first);
+        }
+    }
+
+    writer.write(filename);
+
+    p->msg("Done.", Print::DEBUG);
+}
+
+/*
+ * Add the directories and files of a disc to a snapshot, after the disc.
+ */
+void
+DB::export_disc(SnapshotWriter& writer, sqlite3_int64 disc_id) throw(DBError)
+{
+    const char* dirs_query = "SELECT id, parent_id, name FROM dirs WHERE disc_id=?";
+
+    std::string error_message = "Could not export snapshot";
+
+    int result;
+
+    sqlite3_stmt* stmt;
+
+    // Parents and names of the directories
+    std::map<sqlite3_int64, std::pair<sqlite3_int64, std::string> > tree;
+
+    stmt = prepare(dirs_query, error_message);
+
+    sqlite3_bind_int64(stmt, 1, disc_id);
+
+    while((result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        sqlite3_int64 parent = sqlite3_column_type(stmt, 1) == SQLITE_NULL ? -1 : sqlite3_column_int64(stmt, 1);
+
+        tree[sqlite3_column_int64(stmt, 0)] =
+            std::make_pair(parent, std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2))));
+    }
+
+    if(result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_reset(stmt);
+
+    // Directories in the order of their paths, which puts parents first
+    std::vector<std::pair<std::string, sqlite3_int64> > directories;
+
+    sorted_directories(disc_id, directories);
+
+    std::map<sqlite3_int64, boost::uint32_t> numbers;
+
+    stmt = prepare_listing(NULL);
+
+    for(size_t i = 0; i < directories.size(); i++)
+    {
+        const std::pair<sqlite3_int64, std::string>& directory = tree[directories[i].second];
+
+        boost::uint32_t parent = directory.first < 0 ? snapshot::NO_PARENT : numbers[directory.first];
+
+        numbers[directories[i].second] =
+            writer.add_directory(parent, directory.second.data(), directory.second.length());
+
+        sqlite3_reset(stmt);
+        sqlite3_bind_int64(stmt, 1, directories[i].second);
+
+        while((result = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+            writer.add_file(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                            sqlite3_column_bytes(stmt, 0));
+        }
+
+        if(result != SQLITE_DONE)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+    }
+
+    sqlite3_reset(stmt);
+}
+
+void
+DB::execute(const char* sql, const std::string& error_message, DBError::Type type, bool full_scan) throw(DBError)
+{
+    if(explainer != NULL)
+        explainer->explain(db, sql, full_scan);
+
+    int result =
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+
+    if(result != SQLITE_OK)
+        throw(DBError(error_message + ": " + sqlite3_errmsg(db), type));
+}
+
+/*
+ * Get a prepared statement for the given SQL text. Statements are kept
+ * until the database is closed and handed out reset, without bindings;
+ * callers reset them again when done, so that no read stays open.
+ */
+sqlite3_stmt*
+DB::prepare(const char* sql, const std::string& error_message, bool full_scan) throw(DBError)
+{
+    sqlite3_stmt*& stmt = statement_cache[sql];
+
+    if(stmt != NULL)
+    {
+        statement_hits++;
+
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+
+        return stmt;
+    }
+
+    statement_misses++;
+
+    if(explainer != NULL)
+        explainer->explain(db, sql, full_scan);
+
+    if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    {
+        statement_cache.erase(sql);
+        throw(DBError(error_message + ": " + sqlite3_errmsg(db), DBError::PREPARE_STATEMENT));
+    }
+
+    return stmt;
+}
+
+/*
+ * Add what SQLite counted to the statistics: the work of the cached
+ * statements, which are about to be finalized, and the page cache of the
+ * connection.
+ */
+void
+DB::record_status(void)
+{
+    static const struct { int op; const char* name; } statement_counters[] =
+    {
+        { SQLITE_STMTSTATUS_FULLSCAN_STEP, "sqlite_fullscan_steps" },
+        { SQLITE_STMTSTATUS_SORT,          "sqlite_sorts" },
+        { SQLITE_STMTSTATUS_AUTOINDEX,     "sqlite_autoindexes" },
+        { SQLITE_STMTSTATUS_VM_STEP,       "sqlite_vm_steps" }
+    };
+    static const struct { int op; const char* name; } connection_counters[] =
+    {
+        { SQLITE_DBSTATUS_CACHE_HIT,       "sqlite_cache_hits" },
+        { SQLITE_DBSTATUS_CACHE_MISS,      "sqlite_cache_misses" },
+        { SQLITE_DBSTATUS_CACHE_WRITE,     "sqlite_cache_writes" },
+        { SQLITE_DBSTATUS_CACHE_USED,      "sqlite_cache_bytes" }
+    };
+
+    if(stats == NULL)
+        return;
+
+    std::pair<std::string, sqlite3_stmt*> statement;
+    foreach(statement, statement_cache)
+    {
+        for(size_t i = 0; i < sizeof(statement_counters) / sizeof(statement_counters[0]); i++)
+            stats->add_count(statement_counters[i].name, sqlite3_stmt_status(statement.second, statement_counters[i].op, 0));
+    }
+
+    for(size_t i = 0; i < sizeof(connection_counters) / sizeof(connection_counters[0]); i++)
+    {
+        int current = 0, highwater = 0;
+
+        if(sqlite3_db_status(db, connection_counters[i].op, &current, &highwater, 0) == SQLITE_OK)
+            stats->add_count(connection_counters[i].name, current);
+    }
+}
+
+unsigned long
+DB::get_statement_hits(void)
+{
+    return statement_hits;
+}
+
+unsigned long
+DB::get_statement_misses(void)
+{
+    return statement_misses;
+}
+
+int
+DB::query_int(const char* sql, const std::string& error_message) throw(DBError)
+{
+    return atoi(query_text(sql, error_message).c_str());
+}
+
+std::string
+DB::query_text(const char* sql, const std::string& error_message) throw(DBError)
+{
+    int result;
+
+    std::string value;
+
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(sql, error_message);
+
+    result =
+    sqlite3_step(stmt);
+
+    if(result == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+        value = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    else if(result != SQLITE_ROW && result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_reset(stmt);
+
+    return value;
+}
+
+bool
+DB::has_discs(void) throw(DBError)
+{
+    return query_int("SELECT COUNT(*) FROM (SELECT 1 FROM discs LIMIT 1)", "Could not count discs") > 0;
+}
+
+void
+DB::begin_bulk_load(void) throw(DBError)
+{
+    std::string error_message = "Could not prepare bulk load";
+
+    p->msg("Loading in bulk...", Print::VERBOSE);
+
+    // Remember settings kept in the database file
+    saved_journal_mode = query_text("PRAGMA journal_mode", error_message);
+    saved_synchronous = query_int("PRAGMA synchronous", error_message);
+
+    execute("PRAGMA journal_mode=WAL", error_message);
+    execute("PRAGMA synchronous=NORMAL", error_message);
+    execute("PRAGMA cache_size=-262144", error_message);
+    execute("PRAGMA temp_store=MEMORY", error_message);
+}
+
+void
+DB::end_bulk_load(void) throw(DBError)
+{
+    std::string error_message = "Could not finish bulk load";
+
+    std::ostringstream journal_mode;
+    journal_mode << "PRAGMA journal_mode=" << saved_journal_mode;
+
+    std::ostringstream synchronous;
+    synchronous << "PRAGMA synchronous=" << saved_synchronous;
+
+    // Leaving WAL needs the catalog to itself; with others reading it, it stays in WAL
+    if(sqlite3_exec(db, journal_mode.str().c_str(), NULL, NULL, NULL) != SQLITE_OK)
+        p->msg("Catalog is in use, keeping its write-ahead log", Print::VERBOSE);
+
+    execute(synchronous.str().c_str(), error_message);
+}
+
+void
+DB::insert_files(std::vector<std::pair<sqlite3_int64, const Entry*> >& rows, std::map<size_t, sqlite3_stmt*>& statements) throw(DBError)
+{
+    std::string error_message = "Could not add files";
+
+    int result;
+
+    if(rows.empty())
+        return;
+
+    // Get an insert statement for this number of rows, without building
+    // its text again for every insert
+    sqlite3_stmt*& stmt = statements[rows.size()];
+
+    if(stmt == NULL)
+    {
+        std::string add_file_entries = "INSERT INTO files (dir_id, name, name_key, size, mtime, type, hash) VALUES (?, ?, ?, ?, ?, ?, ?)";
+
+        for(size_t i = 1; i < rows.size(); i++)
+            add_file_entries += ", (?, ?, ?, ?, ?, ?, ?)";
+
+        stmt = prepare(add_file_entries.c_str(), error_message);
+    }
+
+    // Reset SQL statement
+    result =
+    sqlite3_reset(stmt);
+
+    if(result != SQLITE_OK)
+        throw(DBError(error_message, DBError::RESET_STATEMENT));
+
+    // Bind directories and files
+    for(size_t i = 0; i < rows.size(); i++)
+    {
+        result =
+        sqlite3_bind_int64(stmt, FILE_COLUMNS*i + 1, rows[i].first);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::BIND_PARAMETER));
+
+        result =
+        sqlite3_bind_text(stmt, FILE_COLUMNS*i + 2, rows[i].second->file.c_str(), -1, SQLITE_STATIC);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::BIND_PARAMETER));
+
+        const std::string& name = rows[i].second->file;
+        std::string key = normalizer->key(name.data(), name.length());
+
+        result =
+        sqlite3_bind_text(stmt, FILE_COLUMNS*i + 3, key.data(), key.length(), SQLITE_TRANSIENT);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::BIND_PARAMETER));
+
+        result =
+        bind_metadata(stmt, FILE_COLUMNS*i + 4, *rows[i].second);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::BIND_PARAMETER));
+
+        result = rows[i].second->has_hash ?
+                 sqlite3_bind_int64(stmt, FILE_COLUMNS*i + 7, (sqlite3_int64) rows[i].second->hash) :
+                 sqlite3_bind_null(stmt, FILE_COLUMNS*i + 7);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::BIND_PARAMETER));
+    }
+
+    // Execute SQL statement
+    result =
+    sqlite3_step(stmt);
+
+    if(result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    rows.clear();
+}
+
+/*
+ * Prepare the statements of a disc update.
+ */
+void
+DB::prepare_update(Update& update) throw(DBError)
+{
+    const char* add_dir_entry = "INSERT INTO dirs (disc_id, parent_id, name, name_key, mtime, type) VALUES (?, ?, ?, ?, ?, ?)";
+    const char* stored_files = "SELECT id, name, size, mtime, type FROM files WHERE dir_id=? ORDER BY name";
+    const char* stored_dirs = "SELECT id, name, mtime, type FROM dirs WHERE parent_id=? ORDER BY name";
+    const char* change_file = "UPDATE files SET size=?, mtime=?, type=?, hash=NULL WHERE id=?";
+    const char* change_dir = "UPDATE dirs SET mtime=?, type=? WHERE id=?";
+    const char* remove_file = "DELETE FROM files WHERE id=?";
+    const char* remove_subtree_files = "WITH RECURSIVE subtree(id) AS "
+                                       "(SELECT ? UNION ALL SELECT dirs.id FROM dirs JOIN subtree ON dirs.parent_id=subtree.id) "
+                                       "DELETE FROM files WHERE dir_id IN subtree";
+    const char* remove_subtree_dirs = "WITH RECURSIVE subtree(id) AS "
+                                      "(SELECT ? UNION ALL SELECT dirs.id FROM dirs JOIN subtree ON dirs.parent_id=subtree.id) "
+                                      "DELETE FROM dirs WHERE id IN subtree";
+
+    std::string error_message = "Could not update disc";
+
+    update.add_dir = prepare(add_dir_entry, error_message);
+    update.files = prepare(stored_files, error_message);
+    update.dirs = prepare(stored_dirs, error_message);
+    update.change_file = prepare(change_file, error_message);
+    update.change_dir = prepare(change_dir, error_message);
+    update.remove_file = prepare(remove_file, error_message);
+    update.remove_files = prepare(remove_subtree_files, error_message);
+    update.remove_dirs = prepare(remove_subtree_dirs, error_message);
+
+    update.added = update.changed = update.removed = update.skipped = 0;
+}
+
+void
+DB::reset_update(Update& update)
+{
+    sqlite3_reset(update.add_dir);
+    sqlite3_reset(update.files);
+    sqlite3_reset(update.dirs);
+    sqlite3_reset(update.change_file);
+    sqlite3_reset(update.change_dir);
+    sqlite3_reset(update.remove_file);
+    sqlite3_reset(update.remove_files);
+    sqlite3_reset(update.remove_dirs);
+}
+
+/*
+ * Merge the listing of one directory with its stored contents. Both are
+ * sorted by name, so that each side is read only once.
+ */
+void
+DB::update_directory(std::vector<Entry>& listing, Update& update) throw(DBError)
+{
+    std::string error_message = std::string("Could not update directory ") + listing[0].directory;
+
+    // Directory of this listing, known from the listing of its parent
+    std::map<std::string, sqlite3_int64>::iterator it = update.ids.find(listing[0].directory);
+
+    if(it == update.ids.end())
+        throw(DBError(error_message, DBError::WARNING));
+
+    sqlite3_int64 dir_id = it->second;
+    update.ids.erase(it);
+
+    int result;
+
+    // Unchanged directory: only the listings of its subdirectories follow
+    if(listing[0].is_unchanged)
+    {
+        sqlite3_reset(update.dirs);
+        sqlite3_bind_int64(update.dirs, 1, dir_id);
+
+        while((result = sqlite3_step(update.dirs)) == SQLITE_ROW)
+        {
+            fs::path subdirectory = fs::path(listing[0].directory) / reinterpret_cast<const char*>(sqlite3_column_text(update.dirs, 1));
+            update.ids[subdirectory.generic_string()] = sqlite3_column_int64(update.dirs, 0);
+        }
+
+        if(result != SQLITE_DONE)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+        update.skipped++;
+
+        return;
+    }
+
+    // Remember when the directory was read
+    if(listing[0].has_metadata)
+    {
+        sqlite3_reset(update.change_dir);
+        bind_metadata(update.change_dir, 1, listing[0]);
+        sqlite3_bind_int64(update.change_dir, 3, dir_id);
+
+        if(sqlite3_step(update.change_dir) != SQLITE_DONE)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+    }
+
+    // Split the listing into sorted files and subdirectories
+    std::vector<std::pair<std::string, const Entry*> > files;
+    std::vector<std::pair<std::string, const Entry*> > directories;
+
+    for(size_t i = 1; i < listing.size(); i++)
+    {
+        if(listing[i].is_directory)
+            directories.push_back(std::make_pair(fs::path(listing[i].directory).filename().generic_string(), &listing[i]));
+        else
+            files.push_back(std::make_pair(listing[i].file, &listing[i]));
+    }
+
+    std::sort(files.begin(), files.end());
+    std::sort(directories.begin(), directories.end());
+
+    // Merge files
+    size_t max_rows = std::min(rows_per_insert, (size_t) sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1) / FILE_COLUMNS);
+    size_t i = 0;
+
+    sqlite3_reset(update.files);
+    sqlite3_bind_int64(update.files, 1, dir_id);
+
+    result =
+    sqlite3_step(update.files);
+
+    while(i < files.size() || result == SQLITE_ROW)
+    {
+        int order = (result != SQLITE_ROW) ? -1 :
+                    (i == files.size()) ? 1 :
+                    files[i].first.compare(reinterpret_cast<const char*>(sqlite3_column_text(update.files, 1)));
+
+        if(order < 0)
+        {
+            // New file
+            update.rows.push_back(std::make_pair(dir_id, files[i].second));
+            update.added++;
+            i++;
+
+            if(update.rows.size() >= max_rows)
+                insert_files(update.rows, update.insert_statements);
+        }
+        else if(order > 0)
+        {
+            // File gone
+            sqlite3_reset(update.remove_file);
+            sqlite3_bind_int64(update.remove_file, 1, sqlite3_column_int64(update.files, 0));
+
+            if(sqlite3_step(update.remove_file) != SQLITE_DONE)
+                throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+            update.removed++;
+            result = sqlite3_step(update.files);
+        }
+        else
+        {
+            // Same file, maybe with other metadata
+            if(has_other_metadata(*files[i].second, update.files, 2))
+            {
+                sqlite3_reset(update.change_file);
+                bind_metadata(update.change_file, 1, *files[i].second);
+                sqlite3_bind_int64(update.change_file, 4, sqlite3_column_int64(update.files, 0));
+
+                if(sqlite3_step(update.change_file) != SQLITE_DONE)
+                    throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+                update.changed++;
+            }
+
+            i++;
+            result = sqlite3_step(update.files);
+        }
+    }
+
+    if(result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    // Insert new files while the listing is still there
+    if(!update.rows.empty())
+        insert_files(update.rows, update.insert_statements);
+
+    // Merge subdirectories
+    i = 0;
+
+    sqlite3_reset(update.dirs);
+    sqlite3_bind_int64(update.dirs, 1, dir_id);
+
+    result =
+    sqlite3_step(update.dirs);
+
+    while(i < directories.size() || result == SQLITE_ROW)
+    {
+        int order = (result != SQLITE_ROW) ? -1 :
+                    (i == directories.size()) ? 1 :
+                    directories[i].first.compare(reinterpret_cast<const char*>(sqlite3_column_text(update.dirs, 1)));
+
+        if(order < 0)
+        {
+            // New directory, its listing follows
+            sqlite3_reset(update.add_dir);
+            sqlite3_bind_int64(update.add_dir, 1, update.disc_id);
+            sqlite3_bind_int64(update.add_dir, 2, dir_id);
+            sqlite3_bind_text(update.add_dir, 3, directories[i].first.c_str(), -1, SQLITE_STATIC);
+
+            std::string key = normalizer->key(directories[i].first.data(), directories[i].first.length());
+            sqlite3_bind_text(update.add_dir, 4, key.c_str(), -1, SQLITE_STATIC);
+
+            bind_metadata(update.add_dir, 5, *directories[i].second);
+
+            if(sqlite3_step(update.add_dir) != SQLITE_DONE)
+                throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+            update.ids[directories[i].second->directory] = sqlite3_last_insert_rowid(db);
+            update.added++;
+            i++;
+        }
+        else if(order > 0)
+        {
+            // Directory gone with everything below it
+            sqlite3_int64 gone_id = sqlite3_column_int64(update.dirs, 0);
+
+            sqlite3_reset(update.remove_files);
+            sqlite3_bind_int64(update.remove_files, 1, gone_id);
+            sqlite3_reset(update.remove_dirs);
+            sqlite3_bind_int64(update.remove_dirs, 1, gone_id);
+
+            if(sqlite3_step(update.remove_files) != SQLITE_DONE)
+                throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+            update.removed += sqlite3_changes(db);
+
+            if(sqlite3_step(update.remove_dirs) != SQLITE_DONE)
+                throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+            update.removed += sqlite3_changes(db);
+            result = sqlite3_step(update.dirs);
+        }
+        else
+        {
+            // Same directory, its listing follows; its time is set from there
+            sqlite3_int64 same_id = sqlite3_column_int64(update.dirs, 0);
+            const Entry& entry = *directories[i].second;
+            const unsigned char* type = sqlite3_column_text(update.dirs, 3);
+
+            if(entry.has_metadata && (type == NULL || type[0] != entry.type))
+            {
+                sqlite3_reset(update.change_dir);
+                bind_metadata(update.change_dir, 1, entry);
+                sqlite3_bind_int64(update.change_dir, 3, same_id);
+
+                if(sqlite3_step(update.change_dir) != SQLITE_DONE)
+                    throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+                update.changed++;
+            }
+
+            update.ids[entry.directory] = same_id;
+            i++;
+            result = sqlite3_step(update.dirs);
+        }
+    }
+
+    if(result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+}
+
+/*
+ * Bind the metadata of an entry from the given parameter on: size (files
+ * only), modification time and type. Entries without metadata get NULLs.
+ */
+int
+DB::bind_metadata(sqlite3_stmt* stmt, int index, const Entry& entry)
+{
+    int result = SQLITE_OK;
+
+    if(!entry.is_directory)
+    {
+        result = entry.has_metadata ?
+                 sqlite3_bind_int64(stmt, index, entry.size) :
+                 sqlite3_bind_null(stmt, index);
+        index++;
+    }
+
+    // A directory changed in the second it was read may change again
+    // unnoticed, so its time is only kept if older than that
+    if(result == SQLITE_OK)
+        result = (entry.has_metadata && !(entry.is_directory && entry.mtime >= scan_started - 1)) ?
+                 sqlite3_bind_int64(stmt, index, entry.mtime) :
+                 sqlite3_bind_null(stmt, index);
+
+    if(result == SQLITE_OK)
+        result = entry.has_metadata ?
+                 sqlite3_bind_text(stmt, index + 1, &entry.type, 1, SQLITE_TRANSIENT) :
+                 sqlite3_bind_null(stmt, index + 1);
+
+    return result;
+}
+
+/*
+ * Check whether the metadata of a file differs from the stored size,
+ * modification time and type, found from the given column on.
+ */
+bool
+DB::has_other_metadata(const Entry& entry, sqlite3_stmt* stmt, int column)
+{
+    if(!entry.has_metadata)
+        return false;
+
+    const unsigned char* type = sqlite3_column_text(stmt, column + 2);
+
+    return sqlite3_column_type(stmt, column) == SQLITE_NULL ||
+           sqlite3_column_type(stmt, column + 1) == SQLITE_NULL ||
+           type == NULL ||
+           sqlite3_column_int64(stmt, column) != entry.size ||
+           sqlite3_column_int64(stmt, column + 1) != entry.mtime ||
+           type[0] != entry.type;
+}
+
+/*
+ * Add the metadata columns to databases created without them.
+ */
+void
+DB::add_metadata_columns(void) throw(DBError)
+{
+    std::string error_message = "Could not add metadata columns";
+
+    for(size_t i = 0; i < sizeof(added_columns) / sizeof(added_columns[0]); i++)
+    {
+        std::string table = added_columns[i][0];
+        std::string column = added_columns[i][1];
+
+        if(has_column(table.c_str(), column.c_str()))
+            continue;
+
+        std::string add_column = "ALTER TABLE " + table + " ADD COLUMN " + column + " " + added_columns[i][2];
+
+        execute(add_column.c_str(), error_message);
+    }
+}
+
+bool
+DB::has_column(const char* table, const char* column) throw(DBError)
+{
+    std::string has_column = std::string("SELECT COUNT(*) FROM pragma_table_info('") + table + "') WHERE name='" + column + "'";
+
+    return query_int(has_column.c_str(), "Could not check columns") > 0;
+}
+
+/*
+ * Store the numbers of directories and files of the disc with the given
+ * identifier, or of all discs not counted yet for 0, so that listing the
+ * discs does not need to count them.
+ */
+void
+DB::count_entries(sqlite3_int64 disc_id) throw(DBError)
+{
+    std::ostringstream count_query;
+    count_query << "UPDATE discs SET "
+                   "dir_count=(SELECT COUNT(*) FROM dirs WHERE dirs.disc_id=discs.id), "
+                   "file_count=(SELECT COUNT(*) FROM dirs JOIN files ON files.dir_id=dirs.id WHERE dirs.disc_id=discs.id) ";
+
+    if(disc_id == 0)
+        count_query << "WHERE file_count IS NULL";
+    else
+        count_query << "WHERE id=" << disc_id;
+
+    execute(count_query.str().c_str(), "Could not count disc entries");
+}
+
+/*
+ * Discs of a partitioned catalog with their files, in the order of
+ * their names; all of them, those with names like the given one or,
+ * if exact, the one with the given name.
+ */
+void
+DB::find_partitions(const char* disc_name, std::vector<Partition>& parts, bool exact) throw(DBError)
+{
+    std::string partitions_query = "SELECT discs.id, discs.name, ddb_partitions.file FROM discs "
+                                   "JOIN ddb_partitions ON ddb_partitions.disc_id=discs.id ";
+
+    if(disc_name != NULL)
+        partitions_query += exact ? "WHERE discs.name=? " : "WHERE discs.name LIKE ? ";
+
+    partitions_query += "ORDER BY discs.name";
+
+    std::string error_message = "Could not find disc files";
+
+    int result;
+
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(partitions_query.c_str(), error_message);
+
+    if(disc_name != NULL)
+    {
+        result =
+        sqlite3_bind_text(stmt, 1, disc_name, -1, SQLITE_STATIC);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::BIND_PARAMETER));
+    }
+
+    parts.clear();
+
+    while((result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        Partition part;
+        part.disc_id = sqlite3_column_int64(stmt, 0);
+        part.name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        part.file = partition_path(db, reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)));
+
+        parts.push_back(part);
+    }
+
+    if(result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_reset(stmt);
+
+    if(exact && parts.empty())
+        throw(DBError(std::string("Disc ") + disc_name + " is not in the database", DBError::WARNING));
+}
+
+/*
+ * Open the file of a disc with the settings of the master catalog. The
+ * caller owns the returned database.
+ */
+DB*
+DB::open_partition(const std::string& file, bool initialize) throw(DBError)
+{
+    // Keys of all discs must be made the same way
+    prepare_normalizer();
+
+    DB* partition = new DB(p);
+
+    partition->set_insert_sizes(rows_per_insert, rows_per_commit);
+    partition->set_bulk_load(bulk_load);
+    partition->set_metadata(metadata);
+    partition->set_hashing(hash_contents);
+    partition->set_fold_accents(fold_accents);
+    partition->set_stats(stats);
+    partition->set_explainer(explainer);
+
+    try
+    {
+        partition->open(file.c_str(), initialize);
+    }
+    catch(...)
+    {
+        delete partition;
+        throw;
+    }
+
+    return partition;
+}
+
+/*
+ * Add a disc to a file of its own. The master catalog is written only
+ * to reserve the name and to store the counts, so that other processes
+ * may add other discs at the same time.
+ */
+void
+DB::add_partition(const char* disc_name, const char* starting_path, unsigned int jobs) throw(DBError)
+{
+    const char* add_disc_entry = "INSERT INTO discs (name) VALUES (?)";
+    const char* add_partition_entry = "INSERT INTO ddb_partitions (disc_id, file) VALUES (?, ?)";
+
+    std::string error_message = std::string("Could not add disc ") + disc_name;
+
+    int result;
+
+    execute("BEGIN IMMEDIATE", error_message, DBError::BEGIN_TRANSACTION);
+
+    sqlite3_int64 disc_id;
+
+    // Reserve the name, pending with its loader until the file of the disc is loaded
+    try
+    {
+        sqlite3_stmt* stmt;
+
+        stmt = prepare(add_disc_entry, error_message);
+
+        sqlite3_bind_text(stmt, 1, disc_name, -1, SQLITE_STATIC);
+
+        result =
+        sqlite3_step(stmt);
+
+        sqlite3_reset(stmt);
+
+        if(result != SQLITE_DONE)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+        disc_id = sqlite3_last_insert_rowid(db);
+
+        add_pending(disc_id);
+
+        execute("COMMIT", error_message, DBError::END_TRANSACTION);
+    }
+    catch(...)
+    {
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        throw;
+    }
+
+    std::string file = partition_file(db, disc_id);
+
+    // Searches and listings find the disc only once it is complete
+    try
+    {
+        boost::scoped_ptr<DB> partition(open_partition(partition_path(db, file), true));
+
+        partition->add_disc(disc_name, starting_path, jobs);
+
+        // Indexed catalogs index their new discs too
+        if(has_search_index())
+            partition->create_search_index();
+
+        execute("BEGIN IMMEDIATE", error_message, DBError::BEGIN_TRANSACTION);
+
+        sqlite3_stmt* stmt;
+
+        stmt = prepare(add_partition_entry, error_message);
+
+        sqlite3_bind_int64(stmt, 1, disc_id);
+        sqlite3_bind_text(stmt, 2, file.c_str(), -1, SQLITE_TRANSIENT);
+
+        result =
+        sqlite3_step(stmt);
+
+        sqlite3_reset(stmt);
+
+        if(result != SQLITE_DONE)
+            throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+        copy_counts(disc_id, *partition);
+
+        std::ostringstream forget_disc;
+        forget_disc << "DELETE FROM ddb_pending WHERE disc_id=" << disc_id;
+
+        execute(forget_disc.str().c_str(), error_message);
+
+        execute("COMMIT", error_message, DBError::END_TRANSACTION);
+    }
+    catch(...)
+    {
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+
+        abandon_bulk_load(disc_id, disc_name);
+        throw;
+    }
+}
+
+/*
+ * Forget a disc of a partitioned catalog and delete its file.
+ */
+void
+DB::remove_partition(const char* disc_name) throw(DBError)
+{
+    std::string error_message = std::string("Could not remove disc ") + disc_name;
+
+    std::vector<Partition> parts;
+
+    find_partitions(disc_name, parts, true);
+
+    std::ostringstream remove_partition_entry;
+    remove_partition_entry << "DELETE FROM ddb_partitions WHERE disc_id=" << parts[0].disc_id;
+
+    std::ostringstream remove_disc_entry;
+    remove_disc_entry << "DELETE FROM discs WHERE id=" << parts[0].disc_id;
+
+    execute("BEGIN IMMEDIATE", error_message, DBError::BEGIN_TRANSACTION);
+    execute(remove_partition_entry.str().c_str(), error_message);
+    execute(remove_disc_entry.str().c_str(), error_message);
+    execute("COMMIT", error_message, DBError::END_TRANSACTION);
+
+    delete_partition_file(parts[0].file);
+}
+
+// Delete the file of a disc, journals of an interrupted write go with it
+void
+DB::delete_partition_file(const std::string& file)
+{
+    const char* suffixes[] = { "", "-journal", "-wal", "-shm" };
+
+    for(size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+    {
+        boost::system::error_code error;
+
+        fs::remove(file + suffixes[i], error);
+
+        if(error)
+            p->msg((std::string("Could not delete ") + file + suffixes[i]).c_str(), Print::INFO);
+    }
+}
+
+/*
+ * Take the counts of the disc in its file over into the master catalog.
+ */
+void
+DB::copy_counts(sqlite3_int64 disc_id, DB& partition) throw(DBError)
+{
+    std::string error_message = "Could not count disc entries";
+
+    std::ostringstream copy_query;
+    copy_query << "UPDATE discs SET "
+               << "dir_count=" << partition.query_int("SELECT dir_count FROM discs", error_message) << ", "
+               << "file_count=" << partition.query_int("SELECT file_count FROM discs", error_message) << " "
+               << "WHERE id=" << disc_id;
+
+    execute(copy_query.str().c_str(), error_message);
+}
+
+/*
+ * Copies of the same contents on more than one disc of a partitioned
+ * catalog. The file of each disc is attached in turn, first for the
+ * digests it holds, then for its files with digests found on other
+ * discs too.
+ */
+void
+DB::find_partitioned_duplicates(void) throw(DBError)
+{
+    const char* attach = "ATTACH ? AS part";
+    const char* add_digests = "INSERT INTO temp.ddb_digests SELECT DISTINCT ?, hash, size FROM part.files "
+                              "WHERE hash IS NOT NULL AND size > 0";
+    // Paths are built from the directories holding copies up to their roots
+    const char* add_copies = "INSERT INTO temp.ddb_copies "
+                             "WITH RECURSIVE up(dir_id, parent_id, path) AS "
+                             "(SELECT id, parent_id, name FROM part.dirs WHERE id IN "
+                             "(SELECT files.dir_id FROM part.files JOIN temp.ddb_shared shared "
+                             "ON files.hash=shared.hash AND files.size=shared.size) "
+                             "UNION ALL "
+                             "SELECT up.dir_id, dirs.parent_id, "
+                             "CASE WHEN substr(dirs.name, -1)='/' THEN dirs.name || up.path ELSE dirs.name || '/' || up.path END "
+                             "FROM part.dirs JOIN up ON dirs.id=up.parent_id) "
+                             "SELECT shared.hash, shared.size, ?, up.path, files.name FROM part.files "
+                             "JOIN temp.ddb_shared shared ON files.hash=shared.hash AND files.size=shared.size "
+                             "JOIN up ON up.dir_id=files.dir_id AND up.parent_id IS NULL";
+    // Digests are printed unsigned, negative ones come last
+    const char* copies_query = "SELECT disc, path, name, hash, size FROM temp.ddb_copies "
+                               "ORDER BY hash < 0, hash, size, disc, path, name";
+
+    std::string error_message = "Could not find duplicates";
+
+    int result;
+
+    std::vector<Partition> parts;
+
+    find_partitions(NULL, parts);
+
+    execute("DROP TABLE IF EXISTS temp.ddb_digests", error_message);
+    execute("DROP TABLE IF EXISTS temp.ddb_shared", error_message);
+    execute("DROP TABLE IF EXISTS temp.ddb_copies", error_message);
+    execute("CREATE TEMP TABLE ddb_digests (disc_id INTEGER, hash INTEGER, size INTEGER)", error_message);
+    execute("CREATE TEMP TABLE ddb_copies (hash INTEGER, size INTEGER, disc TEXT, path TEXT, name TEXT)", error_message);
+
+    sqlite3_stmt* stmt;
+
+    for(int pass = 0; pass < 2; pass++)
+    {
+        // Digests found on more than one disc
+        if(pass == 1)
+            execute("CREATE TEMP TABLE ddb_shared AS SELECT hash, size FROM temp.ddb_digests "
+                    "GROUP BY hash, size HAVING COUNT(DISTINCT disc_id) > 1", error_message);
+
+        for(size_t i = 0; i < parts.size(); i++)
+        {
+            stmt = prepare(attach, error_message);
+
+            sqlite3_bind_text(stmt, 1, parts[i].file.c_str(), -1, SQLITE_STATIC);
+
+            result =
+            sqlite3_step(stmt);
+
+            sqlite3_reset(stmt);
+
+            if(result != SQLITE_DONE)
+                throw(DBError(error_message + ": " + sqlite3_errmsg(db), DBError::FILE_ERROR));
+
+            stmt = prepare(pass == 0 ? add_digests : add_copies, error_message);
+
+            if(pass == 0)
+                sqlite3_bind_int64(stmt, 1, parts[i].disc_id);
+            else
+                sqlite3_bind_text(stmt, 1, parts[i].name.c_str(), -1, SQLITE_STATIC);
+
+            result =
+            sqlite3_step(stmt);
+
+            sqlite3_reset(stmt);
+
+            execute("DETACH part", error_message);
+
+            if(result != SQLITE_DONE)
+                throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+        }
+    }
+
+    stmt = prepare(copies_query, error_message);
+
+    bool more = true;
+
+    while(more && (result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        // Copies are grouped by digest and size
+        char group[40];
+        int group_length = snprintf(group, sizeof(group), "%016llx %lld",
+                                    (unsigned long long) sqlite3_column_int64(stmt, 3),
+                                    (long long) sqlite3_column_int64(stmt, 4));
+
+        more = p->add_duplicate(group, group_length,
+                                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                                sqlite3_column_bytes(stmt, 0),
+                                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+                                sqlite3_column_bytes(stmt, 1),
+                                reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)),
+                                sqlite3_column_bytes(stmt, 2));
+    }
+
+    if(more && result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_reset(stmt);
+
+    execute("DROP TABLE temp.ddb_digests", error_message);
+    execute("DROP TABLE temp.ddb_shared", error_message);
+    execute("DROP TABLE temp.ddb_copies", error_message);
+}
+
+sqlite3_int64
+DB::add_directory(std::map<std::string, sqlite3_int64>& ids, sqlite3_stmt* stmt, sqlite3_int64 disc_id, const std::string& path, bool is_root, const Entry* entry) throw(DBError)
+{
+    std::string error_message = std::string("Could not add directory ") + path;
+
+    // Directory already known
+    std::map<std::string, sqlite3_int64>::iterator it = ids.find(path);
+
+    if(it != ids.end())
+        return it->second;
+
+    // Parents are added first; a path without a parent is a root
+    fs::path directory(path);
+    std::string parent = directory.parent_path().generic_string();
+
+    if(parent.empty() || parent == path)
+        is_root = true;
+
+    sqlite3_int64 parent_id = is_root ? 0 : add_directory(ids, stmt, disc_id, parent, false);
+    std::string name = is_root ? path : directory.filename().generic_string();
+
+    // Insert the directory
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, disc_id);
+
+    if(is_root)
+        sqlite3_bind_null(stmt, 2);
+    else
+        sqlite3_bind_int64(stmt, 2, parent_id);
+
+    sqlite3_bind_text(stmt, 3, name.c_str(), -1, SQLITE_STATIC);
+
+    std::string key = normalizer->key(name.data(), name.length());
+    sqlite3_bind_text(stmt, 4, key.c_str(), -1, SQLITE_STATIC);
+
+    // Parents added on the way have no metadata
+    if(entry != NULL)
+    {
+        bind_metadata(stmt, 5, *entry);
+    }
+    else
+    {
+        sqlite3_bind_null(stmt, 5);
+        sqlite3_bind_null(stmt, 6);
+    }
+
+    if(sqlite3_step(stmt) != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_int64 id = sqlite3_last_insert_rowid(db);
+    ids[path] = id;
+
+    return id;
+}
+
+void
+DB::load_directories(sqlite3_int64 disc_id, std::map<sqlite3_int64, std::string>& paths) throw(DBError)
+{
+    const char* dirs_query = "SELECT id, parent_id, name FROM dirs WHERE disc_id=? ORDER BY id";
+
+    std::string error_message = "Could not load directories";
+
+    int result;
+
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(dirs_query, error_message);
+
+    sqlite3_bind_int64(stmt, 1, disc_id);
+
+    // Parents are always inserted before their children
+    while((result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        std::string& path = paths[sqlite3_column_int64(stmt, 0)];
+        const char* name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+
+        if(sqlite3_column_type(stmt, 1) == SQLITE_NULL)
+        {
+            path = name;
+        }
+        else
+        {
+            path = paths[sqlite3_column_int64(stmt, 1)];
+            append_name(path, name);
+        }
+    }
+
+    if(result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_reset(stmt);
+}
+
+const std::string&
+DB::directory_path(sqlite3_int64 dir_id, std::map<sqlite3_int64, std::string>& paths) throw(DBError)
+{
+    const char* dir_query = "SELECT parent_id, name FROM dirs WHERE id=?";
+
+    std::string error_message = "Could not find directory";
+
+    // Path already known
+    std::map<sqlite3_int64, std::string>::iterator it = paths.find(dir_id);
+
+    if(it != paths.end())
+        return it->second;
+
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(dir_query, error_message);
+
+    sqlite3_bind_int64(stmt, 1, dir_id);
+
+    if(sqlite3_step(stmt) != SQLITE_ROW)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    bool is_root = (sqlite3_column_type(stmt, 0) == SQLITE_NULL);
+    sqlite3_int64 parent_id = sqlite3_column_int64(stmt, 0);
+    std::string name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+
+    sqlite3_reset(stmt);
+
+    // Build the path from the parent's path
+    std::string path = is_root ? name : directory_path(parent_id, paths);
+
+    if(!is_root)
+        append_name(path, name.c_str());
+
+    return paths[dir_id] = path;
+}
+
+void
+DB::sorted_directories(sqlite3_int64 disc_id, std::vector<std::pair<std::string, sqlite3_int64> >& directories) throw(DBError)
+{
+    std::map<sqlite3_int64, std::string> paths;
+
+    load_directories(disc_id, paths);
+
+    directories.clear();
+    directories.reserve(paths.size());
+
+    std::pair<sqlite3_int64, std::string> path;
+    foreach(path, paths)
+        directories.push_back(std::make_pair(path.second, path.first));
+
+    std::sort(directories.begin(), directories.end());
+}
+
+sqlite3_stmt*
+DB::prepare_listing(const char* pattern, const Matcher* matcher, bool keys) throw(DBError)
+{
+    // The files index delivers the names of a directory in order
+    const char* files_query = "SELECT name FROM files WHERE dir_id=? ORDER BY name";
+    std::string matching_files_query = "SELECT name FROM files WHERE dir_id=? AND " + name_condition(keys ? "name_key" : "name", matcher) + " ORDER BY name";
+
+    std::string error_message = "Could not list files";
+
+    int result;
+
+    sqlite3_stmt* stmt;
+
+    stmt = prepare(pattern == NULL ? files_query : matching_files_query.c_str(), error_message);
+
+    // Binding another pattern recompiles the statement, so bind it only once
+    if(pattern != NULL)
+    {
+        result =
+        bind_name_condition(stmt, pattern, matcher);
+
+        if(result != SQLITE_OK)
+            throw(DBError(error_message, DBError::BIND_PARAMETER));
+    }
+
+    return stmt;
+}
+
+bool
+DB::list_directory(sqlite3_stmt* stmt, const std::string& disc_name, const std::string& path, sqlite3_int64 dir_id) throw(DBError)
+{
+    std::string error_message = "Could not list files";
+
+    int result;
+
+    sqlite3_reset(stmt);
+    sqlite3_bind_int64(stmt, 1, dir_id);
+
+    bool more = true;
+
+    while(more && (result = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        more = p->add_file(disc_name.data(), disc_name.length(), path.data(), path.length(),
+                           reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)),
+                           sqlite3_column_bytes(stmt, 0));
+    }
+
+    if(more && result != SQLITE_DONE)
+        throw(DBError(error_message, DBError::EXECUTE_STATEMENT));
+
+    sqlite3_reset(stmt);
+
+    return more;
 }
@@ -16,6 +16,7 @@
 #define DB_HPP
 
 #include <iostream>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -24,31 +25,180 @@
 #include "error.hpp"
 #include "print.hpp"
 
+struct Entry;
+class Explainer;
+class Matcher;
+class Normalizer;
+class SnapshotWriter;
+class Stats;
+
 class DB
 {
 public:
+    enum Version
+    {
+        UNDEFINED = 0,
+        BASIC = 1,
+        FAST = 2
+    };
     DB(Print* print);
     virtual ~DB(void) throw(DBError);
     void open(const char* dbname, bool initialize = false) throw(DBError);
     void close(void) throw(DBError);
     bool has_correct_format(void) throw(DBError);
+    int get_version(void);
+    void upgrade(void) throw(DBError);
+    bool has_search_index(void) throw(DBError);
+    void create_search_index(void) throw(DBError);
     bool is_disc_present(const char* disc_name) throw(DBError);
-    void add_disc(const char* disc_name, const char* starting_directory) throw(DBError);
+    void add_disc(const char* disc_name, const char* starting_directory, unsigned int jobs = 1) throw(DBError);
+    void update_disc(const char* disc_name, const char* starting_directory, unsigned int jobs = 1) throw(DBError);
+    void set_insert_sizes(size_t rows_per_insert, size_t rows_per_commit);
+    void set_bulk_load(bool bulk_load);
+    void set_metadata(bool metadata);
+    void set_hashing(bool hash_contents);
+    // Ignore accents in the keys of a new catalog
+    void set_fold_accents(bool fold_accents);
+    // Keep each disc of a new catalog in a file of its own
+    void set_partitioned(bool partitioned);
+    void set_printer(Print* print);
+    // Time the phases and count what they handle, NULL to stop
+    void set_stats(Stats* stats);
+    // Explain the plans of the statements before they first run, NULL to stop
+    void set_explainer(Explainer* explainer);
+    // Keep the catalog in memory while serving many requests
+    void map_into_memory(void) throw(DBError);
+    void copy_into_memory(void) throw(DBError);
+    // Removes the discs of bulk loads whose loader is gone; only for commands changing the catalog
+    void recover(void) throw(DBError);
     void remove_disc(const char* disc_name) throw(DBError);
     void list_discs(void) throw(DBError);
     void list_files(const char* disc_name, bool directories_only = false) throw(DBError);
-    void search_text(const char* text, bool directories_only = false) throw(DBError);
+    // Names containing the text, or matching the matcher if one is given
+    void search_text(const char* text, bool directories_only = false, unsigned int jobs = 1, const Matcher* matcher = NULL) throw(DBError);
+    void find_duplicates(void) throw(DBError);
+    void export_snapshot(const char* filename) throw(DBError);
+    unsigned long get_statement_hits(void);
+    unsigned long get_statement_misses(void);
 private:
+    // Statements and counters of a disc update
+    struct Update
+    {
+        sqlite3_int64 disc_id;
+        // Directories whose listing is still to come
+        std::map<std::string, sqlite3_int64> ids;
+        sqlite3_stmt* add_dir;
+        sqlite3_stmt* files;
+        sqlite3_stmt* dirs;
+        sqlite3_stmt* change_file;
+        sqlite3_stmt* change_dir;
+        sqlite3_stmt* remove_file;
+        sqlite3_stmt* remove_files;
+        sqlite3_stmt* remove_dirs;
+        // Files waiting for the next multi-row insert
+        std::vector<std::pair<sqlite3_int64, const Entry*> > rows;
+        std::map<size_t, sqlite3_stmt*> insert_statements;
+        unsigned long added;
+        unsigned long changed;
+        unsigned long removed;
+        unsigned long skipped;
+    };
+    // Disc of a partitioned catalog and the file holding it
+    struct Partition
+    {
+        sqlite3_int64 disc_id;
+        std::string name;
+        std::string file;
+    };
     void init(void);
+    // Statements meant to read all files or directories say so for the explainer
+    sqlite3_stmt* prepare(const char* sql, const std::string& error_message, bool full_scan = false) throw(DBError);
+    void execute(const char* sql, const std::string& error_message, DBError::Type type = DBError::EXECUTE_STATEMENT, bool full_scan = false) throw(DBError);
+    int query_int(const char* sql, const std::string& error_message) throw(DBError);
+    std::string query_text(const char* sql, const std::string& error_message) throw(DBError);
+    bool has_discs(void) throw(DBError);
+    // Keys of the names, for searches ignoring case, composition and possibly accents
+    bool has_name_keys(void) throw(DBError);
+    void add_name_keys(void) throw(DBError);
+    void prepare_normalizer(void) throw(DBError);
+    void begin_bulk_load(void) throw(DBError);
+    void end_bulk_load(void) throw(DBError);
+    // Discs of unfinished bulk loads are kept with their loader, to recover them once it is gone
+    void add_pending(sqlite3_int64 disc_id) throw(DBError);
+    void add_pending_owner(void) throw(DBError);
+    void remove_pending(sqlite3_int64 disc_id, const char* disc_name) throw(DBError);
+    void abandon_bulk_load(sqlite3_int64 disc_id, const char* disc_name) throw(DBError);
+    void delete_disc(const char* disc_name) throw(DBError);
+    void insert_files(std::vector<std::pair<sqlite3_int64, const Entry*> >& rows, std::map<size_t, sqlite3_stmt*>& statements) throw(DBError);
+    void prepare_update(Update& update) throw(DBError);
+    void reset_update(Update& update);
+    void update_directory(std::vector<Entry>& listing, Update& update) throw(DBError);
+    int bind_metadata(sqlite3_stmt* stmt, int index, const Entry& entry);
+    bool has_other_metadata(const Entry& entry, sqlite3_stmt* stmt, int column);
+    void add_metadata_columns(void) throw(DBError);
+    bool has_column(const char* table, const char* column) throw(DBError);
+    void count_entries(sqlite3_int64 disc_id) throw(DBError);
+    void release_free_pages(void) throw(DBError);
+    void record_status(void);
+    void find_partitions(const char* disc_name, std::vector<Partition>& parts, bool exact = false) throw(DBError);
+    DB* open_partition(const std::string& file, bool initialize = false) throw(DBError);
+    void add_partition(const char* disc_name, const char* starting_path, unsigned int jobs) throw(DBError);
+    void remove_partition(const char* disc_name) throw(DBError);
+    void delete_partition_file(const std::string& file);
+    void copy_counts(sqlite3_int64 disc_id, DB& partition) throw(DBError);
+    void find_partitioned_duplicates(void) throw(DBError);
+    void export_disc(SnapshotWriter& writer, sqlite3_int64 disc_id) throw(DBError);
+    sqlite3_int64 add_directory(std::map<std::string, sqlite3_int64>& ids, sqlite3_stmt* stmt, sqlite3_int64 disc_id, const std::string& path, bool is_root, const Entry* entry = NULL) throw(DBError);
+    void load_directories(sqlite3_int64 disc_id, std::map<sqlite3_int64, std::string>& paths) throw(DBError);
+    const std::string& directory_path(sqlite3_int64 dir_id, std::map<sqlite3_int64, std::string>& paths) throw(DBError);
+    // Directories holding files that match, searched by several threads; false if the database cannot be shared
+    bool search_in_parallel(const std::string& query, const std::string& pattern, unsigned int jobs, std::vector<std::pair<sqlite3_int64, std::string> >& found) throw(DBError);
+    void sorted_directories(sqlite3_int64 disc_id, std::vector<std::pair<std::string, sqlite3_int64> >& directories) throw(DBError);
+    // Statement listing the files of a directory, all or those matching the pattern or the matcher
+    sqlite3_stmt* prepare_listing(const char* pattern, const Matcher* matcher = NULL, bool keys = false) throw(DBError);
+    // Prints the files of a directory in order; false once no more are wanted
+    bool list_directory(sqlite3_stmt* stmt, const std::string& disc_name, const std::string& path, sqlite3_int64 dir_id) throw(DBError);
 private:
     // Printer
     Print* p;
+    // Statistics of the run, if wanted
+    Stats* stats;
+    // Query plan diagnostics, if wanted
+    Explainer* explainer;
     // Database handle
     sqlite3* db;
-    // Database version
+    // Pattern of the running search, used by SQL functions
+    const Matcher* matcher;
+    // Makes the keys of names, once they are needed
+    Normalizer* normalizer;
+    bool fold_accents;
+    // Discs are kept in files of their own, listed by this master catalog
+    bool partitioned;
+    // Prepared statements by SQL text, kept until closing
+    std::map<std::string, sqlite3_stmt*> statement_cache;
+    unsigned long statement_hits;
+    unsigned long statement_misses;
+    // Database version created by this class
     int version;
+    // Database version found in the opened file
+    int found_version;
+    // Files per insert statement and per transaction while adding discs
+    size_t rows_per_insert;
+    size_t rows_per_commit;
+    // Load discs with deferred index and relaxed durability
+    bool bulk_load;
+    // Store size, modification time and type of entries
+    bool metadata;
+    // Store digests of file contents while adding discs
+    bool hash_contents;
+    sqlite3_int64 scan_started;
+    std::string saved_journal_mode;
+    int saved_synchronous;
     // Database creation SQL statements
     std::vector<std::string> format;
+    // Search index creation SQL statements, over names or their keys
+    std::vector<std::string> search_index_format;
+    std::vector<std::string> key_search_index_format;
 };
 
 #endif /* DB_HPP */
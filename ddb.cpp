@@ -15,16 +15,27 @@
 #include "ddb.hpp"
 
 #include <iostream>
+#include <sstream>
 #include <vector>
 #include <algorithm>
 #include <utility>
 
+#include <cerrno>
+#include <csignal>
 #include <cstdlib>
 #include <cstring>
 #include <cctype>
 
 #include <getopt.h>
 
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+#include "match.hpp"
+#include "snapshot.hpp"
+#include "socket.hpp"
+
 #include <boost/foreach.hpp>
 
 // Use shortcut from example
@@ -40,72 +51,132 @@ namespace fs = boost::filesystem;
 
 
 
-void
-BasicDatabaseStrategy::initialize_database(void)
-{
-}
+// Set by signals which stop a server
+static volatile sig_atomic_t stop_serving = 0;
 
-bool
-BasicDatabaseStrategy::disc_present(std::string& disc_name)
+static void
+stop_server(int /*signal_number*/)
 {
+    stop_serving = 1;
 }
 
-void
-BasicDatabaseStrategy::add_disc(std::string& disc_name, std::string& disc_directory)
+// Verbosity of the printer, which knows fewer levels than the command line
+static enum Print::Verbosity
+printer_verbosity(int verbosity)
 {
-}
+    int print_verbosity = verbosity < Print::CRITICAL ? Print::CRITICAL :
+                          verbosity > Print::VERBOSE_DEBUG ? Print::VERBOSE_DEBUG :
+                          verbosity;
 
-void
-BasicDatabaseStrategy::remove_disc(std::string& disc_name)
-{
+    return static_cast<enum Print::Verbosity>(print_verbosity);
 }
 
-void
-BasicDatabaseStrategy::list_discs(void)
+
+DDB::DDB(int argc, char** argv) :
+    print(NULL), database(NULL), stats(NULL), explainer(NULL), shared_database(false), out(&std::cout), err(&std::cerr),
+    db_filename(DATABASE_NAME), do_initialize(false),
+    do_add(false), do_list(false), do_remove(false), do_update(false), do_upgrade(false), do_index(false),
+    bulk_load(false), metadata(false), hash_contents(false), fold_accents(false), partitioned(false),
+    do_duplicates(false), assume_yes(false), do_stats(false), json_stats(false), do_explain(false), do_help(false),
+    bad_usage(false), in_memory(false), directories_only(false), glob(false), regex(false), jobs(1), limit(0),
+    format(Print::TEXT), rows_per_insert(256), rows_per_commit(100000), verbosity(0)
 {
+    // If no command line arguments given, print help and exit
+    if(argc == 1)
+    {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+
+    parse(argc, argv);
+
+    if(bad_usage)
+    {
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+
+    if(do_help)
+    {
+        print_help();
+        exit(EXIT_SUCCESS);
+    }
 }
 
-void
-BasicDatabaseStrategy::list_files(std::string& disc_name, std::string& name, bool directories_only)
+DDB::DDB(DB* database, std::ostream& out, std::ostream& err) :
+    print(NULL), database(database), stats(NULL), explainer(NULL), shared_database(true), out(&out), err(&err),
+    db_filename(DATABASE_NAME), do_initialize(false),
+    do_add(false), do_list(false), do_remove(false), do_update(false), do_upgrade(false), do_index(false),
+    bulk_load(false), metadata(false), hash_contents(false), fold_accents(false), partitioned(false),
+    do_duplicates(false), assume_yes(false), do_stats(false), json_stats(false), do_explain(false), do_help(false),
+    bad_usage(false), in_memory(false), directories_only(false), glob(false), regex(false), jobs(1), limit(0),
+    format(Print::TEXT), rows_per_insert(256), rows_per_commit(100000), verbosity(0)
 {
 }
 
-
-DDB::DDB(int argc, char** argv) :
-    db_filename(DATABASE_NAME), do_initialize(false),
-    do_add(false), do_list(false), do_remove(false),
-    directories_only(false), verbosity(0)
+DDB::~DDB(void)
 {
+    if(!shared_database)
+        delete database;
 
+    delete print;
+    delete stats;
+    delete explainer;
+}
 
-    // Parse command line arguments
+void
+DDB::parse(int argc, char** argv)
+{
     // Getopt variables
     int ch, option_index;
     static struct option long_options[] =
     {
         {"add",          required_argument, 0, 'a'},
+        {"batch",        required_argument, 0, 'b'},
+        {"bulk",         no_argument,       0, 'B'},
+        {"commit",       required_argument, 0, 'c'},
+        {"connect",      required_argument, 0, 'C'},
         {"directory",    no_argument,       0, 'd'},
+        {"duplicates",   no_argument,       0, 'D'},
+        {"explain",      no_argument,       0, 'X'},
+        {"export-snapshot", required_argument, 0, 'E'},
+        {"regex",        no_argument,       0, 'e'},
         {"file",         required_argument, 0, 'f'},
+        {"fold-accents", no_argument,       0, 'A'},
+        {"format",       required_argument, 0, 'F'},
+        {"glob",         no_argument,       0, 'g'},
+        {"hash",         no_argument,       0, 'H'},
         {"help",         no_argument,       0, 'h'},
+        {"index",        no_argument,       0, 'x'},
         {"initialize",   no_argument,       0, 'i'},
+        {"jobs",         required_argument, 0, 'j'},
+        {"limit",        required_argument, 0, 'n'},
         {"list",         optional_argument, 0, 'l'},
+        {"memory",       no_argument,       0, 'M'},
+        {"metadata",     no_argument,       0, 'm'},
+        {"partitioned",  no_argument,       0, 'P'},
         {"quite",        no_argument,       0, 'q'},
         {"remove",       required_argument, 0, 'r'},
+        {"serve",        required_argument, 0, 'S'},
+        {"snapshot",     required_argument, 0, 's'},
+        {"stats",        optional_argument, 0, 't'},
+        {"update",       required_argument, 0, 'U'},
+        {"upgrade",      no_argument,       0, 'u'},
         {"verbose",      no_argument,       0, 'v'},
+        {"yes",          no_argument,       0, 'y'},
         { 0,             0,                 0,  0 }
     };
 
-    // If no command line arguments given, print help and exit
-    if(argc == 1)
-    {
-        print_help();
-        exit(EXIT_FAILURE);
-    }
+    // Keep the arguments for a server
+    arguments.assign(argv + 1, argv + argc);
+
+    // Start over, a server parses many command lines
+    optind = 0;
 
     // Process command line arguments
     while(true)
     {
-        ch = getopt_long(argc, argv, "a:df:hilqr:v", long_options, &option_index);
+        ch = getopt_long(argc, argv, "a:Ab:Bc:C:dDeE:f:F:ghHij:lmMn:Pqr:s:S:t::uU:vxXy", long_options, &option_index);
 
         if(ch == -1)
             break;
@@ -118,20 +189,85 @@ DDB::DDB(int argc, char** argv) :
                 disc_name = optarg;
                 break;
 
+            // Keys of names without accents
+            case 'A':
+                fold_accents = true;
+                break;
+
+            // Files per insert statement
+            case 'b':
+                rows_per_insert = atoi(optarg) > 1 ? atoi(optarg) : 1;
+                break;
+
+            // Bulk load
+            case 'B':
+                bulk_load = true;
+                break;
+
+            // Files per transaction
+            case 'c':
+                rows_per_commit = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+
+            // Ask a server
+            case 'C':
+                connect_socket = optarg;
+                break;
+
             // Directories only
             case 'd':
                 directories_only = true;
                 break;
 
+            // Copies of the same contents
+            case 'D':
+                do_duplicates = true;
+                break;
+
+            // Search with a regular expression
+            case 'e':
+                regex = true;
+                break;
+
+            // Write a snapshot
+            case 'E':
+                export_filename = optarg;
+                break;
+
             // Database File
             case 'f':
                 db_filename = optarg;
                 break;
 
+            // Layout of the results
+            case 'F':
+                if(strcmp(optarg, "text") == EQUAL)
+                    format = Print::TEXT;
+                else if(strcmp(optarg, "nul") == EQUAL)
+                    format = Print::NUL;
+                else if(strcmp(optarg, "tsv") == EQUAL)
+                    format = Print::TSV;
+                else if(strcmp(optarg, "jsonl") == EQUAL)
+                    format = Print::JSON_LINES;
+                else if(strcmp(optarg, "binary") == EQUAL)
+                    format = Print::BINARY;
+                else
+                    bad_usage = true;
+                break;
+
+            // Search with a glob
+            case 'g':
+                glob = true;
+                break;
+
             // Help
             case 'h':
-                print_help();
-                exit(EXIT_SUCCESS);
+                do_help = true;
+                break;
+
+            // Hash file contents
+            case 'H':
+                hash_contents = true;
                 break;
 
             // Initialize
@@ -139,6 +275,11 @@ DDB::DDB(int argc, char** argv) :
                 do_initialize = true;
                 break;
 
+            // Number of directory walking threads
+            case 'j':
+                jobs = atoi(optarg) > 1 ? atoi(optarg) : 1;
+                break;
+
             // List
             case 'l':
                 do_list = true;
@@ -148,6 +289,26 @@ DDB::DDB(int argc, char** argv) :
                 }
                 break;
 
+            // Size, time and type of files
+            case 'm':
+                metadata = true;
+                break;
+
+            // Serve from a copy in memory
+            case 'M':
+                in_memory = true;
+                break;
+
+            // Number of results
+            case 'n':
+                limit = atoi(optarg) > 0 ? atoi(optarg) : 0;
+                break;
+
+            // Each disc in a file of its own
+            case 'P':
+                partitioned = true;
+                break;
+
             // Quite
             case 'q':
                 verbosity--;
@@ -159,57 +320,187 @@ DDB::DDB(int argc, char** argv) :
                 disc_name = optarg;
                 break;
 
+            // Read a snapshot instead of the database
+            case 's':
+                snapshot_filename = optarg;
+                break;
+
+            // Serve requests
+            case 'S':
+                serve_socket = optarg;
+                break;
+
+            // Time the phases of the run
+            case 't':
+                do_stats = true;
+                if(optarg && strcmp(optarg, "json") == EQUAL)
+                    json_stats = true;
+                else if(optarg)
+                    bad_usage = true;
+                break;
+
+            // Update disc
+            case 'U':
+                do_update = true;
+                disc_name = optarg;
+                break;
+
+            // Upgrade database
+            case 'u':
+                do_upgrade = true;
+                break;
+
             // Verbosity
             case 'v':
                 verbosity++;
                 break;
 
+            // Search index
+            case 'x':
+                do_index = true;
+                break;
+
+            // Query plan diagnostics
+            case 'X':
+                do_explain = true;
+                break;
+
+            // Do not ask for confirmation
+            case 'y':
+                assume_yes = true;
+                break;
+
             // Unknown options
             default:
-                print_help();
-                exit(EXIT_FAILURE);
+                bad_usage = true;
                 break;
         }
     }
 
     // Save last argument
-    if(argv[argc-1][0] != '-')
+    if(argc > 1 && argv[argc-1][0] != '-')
     {
         argument = argv[argc-1];
     }
 }
 
-DDB::~DDB(void)
-{
-}
-
 void
 DDB::run(void) throw (DDBError)
 {
-    int result;
     bool success = true;
 
-    // Open database
-    msg(VERBOSE, "Opening database...");
-    result =
-    sqlite3_open(db_filename.c_str(), &db);
-    msg(DEBUG, "Done.");
+    // Let a running server answer
+    if(!connect_socket.empty())
+    {
+        send_request();
+        return;
+    }
+
+    if(!snapshot_filename.empty())
+    {
+        read_snapshot();
+        return;
+    }
+
+    double started = Stats::now();
+
+    if(do_stats)
+        stats = new Stats();
 
-    if(result != SQLITE_OK)
+    if(do_explain)
+        explainer = new Explainer();
+
+    // Messages of the database go through the printer
+    print = new Print(printer_verbosity(verbosity));
+    print->set_limit(limit);
+    print->set_format(format);
+    print->set_stats(stats);
+    database = new DB(print);
+    database->set_fold_accents(fold_accents);
+    database->set_partitioned(partitioned);
+    database->set_stats(stats);
+    database->set_explainer(explainer);
+
+    try
     {
-        std::string msg = "Error while opening database " +
-                          db_filename + " : " + sqlite3_errmsg(db);
-        throw DDBError(msg);
+        // Open database
+        {
+            Stats::Timer timer(stats, "open");
+
+            database->open(db_filename.c_str(), do_initialize);
+        }
+
+        // Check whether the database has the right format
+        if(!do_initialize && !database->has_correct_format())
+        {
+            if(database->get_version() == DB::BASIC && do_upgrade)
+            {
+                success =
+                upgrade_database();
+
+                if(!success && verbosity >= 1)
+                {
+                    throw DDBError("Error upgrading database");
+                }
+            }
+            else if(database->get_version() == DB::BASIC)
+            {
+                std::string msg = "Database " + db_filename + " has an old format, upgrade it with -u";
+                throw DDBError(msg);
+            }
+            else
+            {
+                std::string msg = "Wrong database " + db_filename;
+                throw DDBError(msg);
+            }
+        }
+
+        // Clean up after interrupted bulk loads; searches and listings
+        // must not, as they cannot hold off a loader still running
+        if(do_add || do_update || do_remove || do_upgrade || do_index)
+            database->recover();
+
+        if(!serve_socket.empty())
+            serve();
+        else
+            dispatch();
+
+        // Close database
+        {
+            Stats::Timer timer(stats, "close");
+
+            database->close();
+        }
+    }
+    catch(DBError& e)
+    {
+        throw DDBError(e.get_message());
     }
 
-    // Check whether the database has table ddb
-    if(!do_initialize && !is_discdb())
+    // Summary after the results, on the stream of the messages
+    if(stats != NULL)
     {
-        sqlite3_close(db);
+        stats->add_time("total", Stats::now() - started);
+        stats->print(*err, json_stats);
+    }
 
-        std::string msg = "Wrong database " + db_filename;
-        throw DDBError(msg);
+    if(explainer != NULL)
+    {
+        unsigned long regressions = explainer->report(*err, verbosity > 0);
+
+        if(regressions > 0)
+        {
+            std::ostringstream msg;
+            msg << "Statements scanning files or directories instead of using an index: " << regressions;
+            throw DDBError(msg.str());
+        }
     }
+}
+
+void
+DDB::dispatch(void) throw (DDBError, DBError)
+{
+    bool success = true;
 
     // Choose functionality to run
     if(do_add)
@@ -223,6 +514,17 @@ DDB::run(void) throw (DDBError)
             throw DDBError(msg);
         }
     }
+    else if(do_update)
+    {
+        success =
+        update_disc();
+
+        if(!success && verbosity >= 1)
+        {
+            std::string msg = "Error while updating disc " + disc_name;
+            throw DDBError(msg);
+        }
+    }
     else if(do_remove)
     {
         success =
@@ -234,6 +536,16 @@ DDB::run(void) throw (DDBError)
             throw DDBError(msg);
         }
     }
+    else if(!export_filename.empty())
+    {
+        success =
+        export_snapshot();
+
+        if(!success && verbosity >= 1)
+        {
+            throw DDBError("Error exporting snapshot");
+        }
+    }
     else if(do_list)
     {
         success =
@@ -254,6 +566,31 @@ DDB::run(void) throw (DDBError)
             throw DDBError("Error initializing database");
         }
     }
+    else if(do_index)
+    {
+        success =
+        create_index();
+
+        if(!success && verbosity >= 1)
+        {
+            throw DDBError("Error creating search index");
+        }
+    }
+    else if(do_duplicates)
+    {
+        success =
+        list_duplicates();
+
+        if(!success && verbosity >= 1)
+        {
+            throw DDBError("Error while finding duplicates");
+        }
+    }
+    else if(do_upgrade)
+    {
+        // Old formats were upgraded already, current ones may still lack incremental vacuum
+        database->upgrade();
+    }
     else    // If nothing else specified, search text
     {
         success =
@@ -264,253 +601,248 @@ DDB::run(void) throw (DDBError)
             throw DDBError("Error searching");
         }
     }
-
-    // Close database
-    msg(VERBOSE, "Closing database...");
-    sqlite3_close(db);
-    msg(DEBUG, "Done.");
 }
 
-bool
-DDB::is_discdb(void)
+void
+DDB::serve(void) throw (DDBError, DBError)
 {
-    const char* check_discdb_table =
-        "SELECT sql FROM "
-        "(SELECT sql sql, type type, tbl_name tbl_name, name name FROM "
-        "sqlite_master UNION ALL "
-        "SELECT sql, type, tbl_name, name FROM sqlite_temp_master) "
-        "WHERE tbl_name LIKE '"TABLE_NAME"' AND type!='meta' AND sql NOTNULL "
-        "ORDER BY substr(type,2,1), name";
-    int result;
-    sqlite3_stmt* stmt;
+    // Requests find the catalog in memory instead of reading the file
+    if(in_memory)
+        database->copy_into_memory();
+    else
+        database->map_into_memory();
 
-    sqlite3_prepare_v2(db, check_discdb_table, -1, &stmt, NULL);
+    LocalSocket server;
+    std::string error;
 
-    result =
-    sqlite3_step(stmt);
+    if(!server.listen(serve_socket, error))
+        throw DDBError(error);
 
-    if(result != SQLITE_ROW || sqlite3_column_count(stmt) != 1)
-    {
-        std::string err_msg = "Error checking database: ";
-                    err_msg += sqlite3_errmsg(db);
-        msg(INFO, err_msg, NEXT_PARAGRAPH);
+#ifndef _WIN32
+    // Without restarting, signals interrupt waiting for connections
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigemptyset(&action.sa_mask);
 
-        sqlite3_finalize(stmt);
-        return false;
-    }
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+#endif
 
-    const char* schema = (const char*) sqlite3_column_text(stmt, 0);
+    msg(INFO, "Serving " + db_filename + " on " + serve_socket);
 
-    if(strncmp(schema, discdb_schema, strlen(discdb_schema)) != 0)
+    // Requests are short, answer them one after another
+    while(!stop_serving)
     {
-        msg(INFO, "Database has wrong schema!", NEXT_PARAGRAPH);
+        LocalSocket client;
+        std::string request;
 
-        sqlite3_finalize(stmt);
-        return false;
-    }
+        if(!server.accept(client))
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
 
-    result =
-    sqlite3_step(stmt);
+            throw DDBError("Could not accept connection on " + serve_socket);
+        }
 
-    if(result != SQLITE_DONE)
-    {
-        std::string err_msg = "Something wrong with the database: ";
-                    err_msg += sqlite3_errmsg(db);
-        msg(INFO, err_msg, NEXT_PARAGRAPH);
+        if(!client.receive(request))
+            continue;
 
-        sqlite3_finalize(stmt);
-        return false;
+        client.send(answer(request));
     }
 
-    sqlite3_finalize(stmt);
-    return true;
+    msg(INFO, "Server stopped");
 }
 
-bool
-DDB::is_disc_present(std::string& name)
+std::string
+DDB::answer(const std::string& request)
 {
-    const char* disc_present =
-        "SELECT DISTINCT disc FROM ddb WHERE disc LIKE ?";
-    int result;
-    sqlite3_stmt* stmt;
+    // Arguments arrive terminated by NUL characters
+    std::vector<std::vector<char> > words;
+    std::string program = "ddb";
 
-    sqlite3_prepare_v2(db, disc_present, -1, &stmt, NULL);
+    words.push_back(std::vector<char>(program.begin(), program.end()));
 
-    sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
+    size_t start = 0, end;
+
+    while((end = request.find('\0', start)) != std::string::npos)
+    {
+        words.push_back(std::vector<char>(request.begin() + start, request.begin() + end));
+        start = end + 1;
+    }
 
-    result =
-    sqlite3_step(stmt);
+    std::vector<char*> argv;
 
-    // A row means that the disc is present
-    if(result == SQLITE_ROW)
+    foreach(std::vector<char>& word, words)
     {
-        sqlite3_finalize(stmt);
-        return true;
+        word.push_back('\0');
+        argv.push_back(&word[0]);
+    }
+
+    argv.push_back(NULL);
+
+    std::ostringstream results, messages;
+    bool success;
+
+    {
+        DDB request(database, results, messages);
+
+        success =
+        request.respond(argv.size() - 1, &argv[0]);
+
+        // The printer of the request goes away with it
+        database->set_printer(print);
     }
 
-    sqlite3_finalize(stmt);
-    return false;
+    // Status and length of the results lead, messages follow the results
+    std::ostringstream response;
+    response << (success ? 0 : 1) << ' ' << results.str().length() << '\n'
+             << results.str() << messages.str();
+
+    return response.str();
 }
 
 bool
-DDB::add_disc(void)
+DDB::respond(int argc, char** argv)
 {
-    const char* begin_transaction = "BEGIN";
-    const char* add_entry =
-        "INSERT INTO ddb (directory, file, disc) VALUES (?, ?, ?)";
-    const char* end_transaction = "COMMIT";
-
-    int result;
-    char* error_message = NULL;
+    // Complaints would end up with the server instead of the client
+    opterr = 0;
+    parse(argc, argv);
+    opterr = 1;
 
-    // Declare disc root directory
-    fs::path disc_path(argument);
-
-    // Check whether the disc is already in the database
-    if(is_disc_present(disc_name))
+    if(argc == 1 || bad_usage)
     {
-        std::string err_msg = "Disc " + disc_name + " already present in the database!";
-        msg(CRITICAL, err_msg, NEXT_PARAGRAPH);
-
+        print_help(*err);
         return false;
     }
 
-    // Check whether the given argument is a directory
-    if(! fs::is_directory(disc_path))
+    if(do_help)
     {
-        std::string err_msg = argument + " is not a directory!";
-        msg(CRITICAL, err_msg, NEXT_PARAGRAPH);
+        print_help(*err);
+        return true;
+    }
 
+    // Changing the catalog is left to ddb running on its own
+    if(do_add || do_update || do_remove || do_initialize || do_upgrade || do_index ||
+       !serve_socket.empty() || !export_filename.empty() || !snapshot_filename.empty())
+    {
+        msg(CRITICAL, "Only searching and listing are served, run ddb without -C to change the database");
         return false;
     }
 
-    // Collect file names
-    std::vector<std::pair<fs::path, bool> > filenames;
-
-    // Open directory and iterate through it recursively
-    fs::path current_path;
-    bool current_path_is_directory;
-    fs::recursive_directory_iterator end;
+    print = new Print(printer_verbosity(verbosity), *out);
+    print->set_limit(limit);
+    print->set_format(format);
+    database->set_printer(print);
 
-    for(fs::recursive_directory_iterator dir(disc_path);
-        dir != end;
-        dir++)
+    try
     {
-        current_path = dir->path();
-        current_path_is_directory = fs::is_directory(current_path);
-
-        // Put current file name into vector
-        filenames.push_back(std::make_pair(current_path, current_path_is_directory));
+        dispatch();
     }
-
-    // Sort filenames
-    sort(filenames.begin(),filenames.end());
-
-    // Print file names, if verbosity is set high enough
-    if(verbosity >= VERBOSE_DEBUG)
+    catch(DDBError& e)
     {
-        std::pair<fs::path, bool> it;
-        foreach(it, filenames)
-        {
-            std::cout << (it.second ? "Directory" : "File") << " " << it.first << std::endl;
-        }
+        *err << e.what() << std::endl;
+        return false;
     }
-
-    // Begin SQL transaction
-    msg(VERBOSE, "Inserting files into database...");
-    result =
-    sqlite3_exec(db, begin_transaction, NULL, NULL, &error_message);
-
-    if(result != SQLITE_OK)
+    catch(DBError& e)
     {
-        std::string err_msg = "Error while beginning add transaction: ";
-                    err_msg += error_message;
-        msg(DEBUG, err_msg, NEXT_PARAGRAPH);
-
-        sqlite3_free(error_message);
-
+        *err << e.what() << std::endl;
         return false;
     }
 
-    // Prepare SQL statement
-    sqlite3_stmt* stmt;
+    return true;
+}
 
-    sqlite3_prepare_v2(db, add_entry, -1, &stmt, NULL);
+void
+DDB::send_request(void) throw (DDBError)
+{
+    LocalSocket server;
+    std::string error;
 
-    // Bind disc name
-    sqlite3_bind_text(stmt, 3, disc_name.c_str(), -1, SQLITE_STATIC);
+    if(!server.connect(connect_socket, error))
+        throw DDBError(error);
 
-    // Add files
-    bool file_is_directory;
-    fs::path path;
-    std::string d_entry;
-    std::string f_entry;
+    // Arguments go terminated by NUL characters
+    std::string request;
 
-    std::pair<fs::path, bool> it;
-    foreach(it, filenames)
+    foreach(std::string& word, arguments)
     {
-        path = it.first;
-        file_is_directory = it.second;
+        request += word;
+        request += '\0';
+    }
 
-        d_entry = file_is_directory ?
-                    path.generic_string() :
-                    path.parent_path().generic_string();
+    std::string response;
 
-        f_entry = file_is_directory ?
-                    "NULL" :
-                    path.filename().generic_string();
+    if(!server.send(request))
+        throw DDBError("Could not send request to " + connect_socket);
 
-        // Reset SQL statement
-        sqlite3_reset(stmt);
+    server.finish();
 
-        // Bind directory and file
-        sqlite3_bind_text(stmt, 1, d_entry.c_str(), -1, SQLITE_STATIC);
-        sqlite3_bind_text(stmt, 2, f_entry.c_str(), -1, SQLITE_STATIC);
+    if(!server.receive(response))
+        throw DDBError("Could not receive answer from " + connect_socket);
 
-        // Execute SQL statement
-        result =
-        sqlite3_step(stmt);
+    // Status and length of the results lead the answer
+    size_t header_end = response.find('\n');
+    int status = 1;
+    size_t length = 0;
 
-        // Check for errors
-        if(result != SQLITE_DONE)
-        {
-            sqlite3_finalize(stmt);
+    std::istringstream header(response.substr(0, header_end));
+    header >> status >> length;
 
-            msg(DEBUG, "Error while add transaction!", NEXT_PARAGRAPH);
+    if(header_end == std::string::npos || header.fail() || header_end + 1 + length > response.length())
+        throw DDBError("Malformed answer from " + connect_socket);
 
-            return false;
-        }
-    }
+    std::cout.write(response.data() + header_end + 1, length);
 
-    sqlite3_finalize(stmt);
+    std::string messages = response.substr(header_end + 1 + length);
 
+    // Failures are reported with the messages explaining them
+    if(status != 0)
+    {
+        while(!messages.empty() && messages[messages.length() - 1] == '\n')
+            messages.erase(messages.length() - 1);
 
-    // End SQL transaction
-    result =
-    sqlite3_exec(db, end_transaction, NULL, NULL, &error_message);
+        throw DDBError(messages);
+    }
+
+    std::cerr << messages;
+}
 
-    if(result != SQLITE_OK)
+bool
+DDB::add_disc(void)
+{
+    // Check whether the disc is already in the database
+    if(database->is_disc_present(disc_name.c_str()))
     {
-        std::string err_msg = "Error while ending add transaction: ";
-                    err_msg += error_message;
-        msg(DEBUG, err_msg, NEXT_PARAGRAPH);
+        std::string err_msg = "Disc " + disc_name + " already present in the database!";
+        msg(CRITICAL, err_msg, NEXT_PARAGRAPH);
+
+        return false;
+    }
 
-        sqlite3_free(error_message);
+    // Check whether the given argument is a directory
+    if(! fs::is_directory(fs::path(argument)))
+    {
+        std::string err_msg = argument + " is not a directory!";
+        msg(CRITICAL, err_msg, NEXT_PARAGRAPH);
 
         return false;
     }
-    msg(DEBUG, "Done.");
+
+    database->set_insert_sizes(rows_per_insert, rows_per_commit);
+    database->set_bulk_load(bulk_load);
+    database->set_metadata(metadata);
+    database->set_hashing(hash_contents);
+    database->add_disc(disc_name.c_str(), argument.c_str(), jobs);
 
     return true;
 }
 
 bool
-DDB::remove_disc(void)
+DDB::update_disc(void)
 {
-    const char* remove_query = "DELETE FROM ddb WHERE disc=?";
-
     // Check whether the disc is in the database
-    if(! is_disc_present(disc_name))
+    if(! database->is_disc_present(disc_name.c_str()))
     {
         std::string err_msg = "Disc " + disc_name + " is not in the database!";
         msg(CRITICAL, err_msg, NEXT_PARAGRAPH);
@@ -518,47 +850,106 @@ DDB::remove_disc(void)
         return false;
     }
 
-    // Ask user for confirmation
-    char c;
-    std::cout << "Remove disc " << disc_name << " from database? (y/n): ";
-    std::cin >> c;
+    // Check whether the given argument is a directory
+    if(! fs::is_directory(fs::path(argument)))
+    {
+        std::string err_msg = argument + " is not a directory!";
+        msg(CRITICAL, err_msg, NEXT_PARAGRAPH);
 
-    if(c == 'y')
+        return false;
+    }
+
+    database->set_insert_sizes(rows_per_insert, rows_per_commit);
+    database->set_metadata(metadata);
+    database->update_disc(disc_name.c_str(), argument.c_str(), jobs);
+
+    return true;
+}
+
+bool
+DDB::remove_disc(void)
+{
+    // Check whether the disc is in the database
+    if(! database->is_disc_present(disc_name.c_str()))
     {
-        msg(VERBOSE, "Removing of the disc confirmed.");
+        std::string err_msg = "Disc " + disc_name + " is not in the database!";
+        msg(CRITICAL, err_msg, NEXT_PARAGRAPH);
+
+        return false;
     }
-    else
+
+    // Ask user for confirmation, unless told not to; no answer means no
+    if(!assume_yes)
     {
-        msg(VERBOSE, "Removing of the disc canceled.");
-        return true;
+        char c = 'n';
+        std::cout << "Remove disc " << disc_name << " from database? (y/n): ";
+        std::cin >> c;
+
+        if(c == 'y')
+        {
+            msg(VERBOSE, "Removing of the disc confirmed.");
+        }
+        else
+        {
+            msg(VERBOSE, "Removing of the disc canceled.");
+            return true;
+        }
     }
 
-    // Initialize and prepare SQL statement
-    int result;
-    sqlite3_stmt* stmt;
+    database->remove_disc(disc_name.c_str());
 
-    sqlite3_prepare_v2(db, remove_query, -1, &stmt, NULL);
+    return true;
+}
 
-    sqlite3_bind_text(stmt, 1, disc_name.c_str(), -1, SQLITE_STATIC);
+bool
+DDB::export_snapshot(void)
+{
+    msg(VERBOSE, "Exporting snapshot " + export_filename + "...");
 
-    // Execute SQL statement
-    result =
-    sqlite3_step(stmt);
+    database->export_snapshot(export_filename.c_str());
 
-    // Check for errors
-    if(result != SQLITE_DONE)
+    return true;
+}
+
+void
+DDB::read_snapshot(void) throw (DDBError)
+{
+    if(do_add || do_update || do_remove || do_initialize || do_upgrade || do_index || do_duplicates ||
+       !serve_socket.empty() || !export_filename.empty())
     {
-        sqlite3_finalize(stmt);
+        throw DDBError("Only searching and listing work on snapshots");
+    }
 
-        msg(DEBUG, "Error removing disc!", NEXT_PARAGRAPH);
+    print = new Print(printer_verbosity(verbosity));
+    print->set_limit(limit);
+    print->set_format(format);
 
-        return false;
-    }
+    Snapshot snapshot(print);
 
-    // Clean up
-    sqlite3_finalize(stmt);
+    try
+    {
+        snapshot.open(snapshot_filename.c_str());
+
+        if(do_list && directories_only)
+            snapshot.list_files(argument.c_str(), true);
+        else if(do_list && argument.length() > 0)
+            snapshot.list_files(argument.c_str(), false);
+        else if(do_list)
+            snapshot.list_discs();
+        else if(glob || regex)
+        {
+            Matcher matcher(argument.c_str(), glob ? Matcher::GLOB : Matcher::REGEX);
+            snapshot.search_text(argument.c_str(), directories_only, &matcher);
+        }
+        else
+            snapshot.search_text(argument.c_str(), directories_only);
 
-    return true;
+        print->output();
+    }
+    catch(DBError& e)
+    {
+        throw DDBError(e.get_message());
+    }
 }
 
 bool
@@ -581,49 +972,8 @@ DDB::list_contents(void)
 bool
 DDB::list_discs(void)
 {
-    const char* list_discs = "SELECT DISTINCT disc FROM ddb";
-    int result;
-    sqlite3_stmt* stmt;
-    std::vector<std::string> discs;
-
-    sqlite3_prepare_v2(db, list_discs, -1, &stmt, NULL);
-
-    // Fetch results
-    while(true)
-    {
-        result =
-        sqlite3_step(stmt);
-
-        if(result == SQLITE_ROW)
-        {
-            // Store results
-            std::string s = (const char*) sqlite3_column_text(stmt, 0);
-            discs.push_back(s);
-        }
-        else    // End or error
-        {
-            sqlite3_finalize(stmt);
-
-            if(result == SQLITE_DONE)
-            {
-                break;
-            }
-            else
-            {
-                msg(INFO, "Error while listing contents!", NEXT_PARAGRAPH);
-
-                return false;
-            }
-        }
-    }
-
-    // Sort and print results
-    sort(discs.begin(), discs.end());
-
-    foreach(std::string disc, discs)
-    {
-        std::cout << disc << std::endl;
-    }
+    database->list_discs();
+    print->output();
 
     return true;
 }
@@ -631,52 +981,8 @@ DDB::list_discs(void)
 bool
 DDB::list_directories(void)
 {
-    const char* list_dirs =
-        "SELECT DISTINCT directory FROM ddb WHERE disc LIKE ?";
-    int result;
-    sqlite3_stmt* stmt;
-    std::vector<std::string> directories;
-
-    sqlite3_prepare_v2(db, list_dirs, -1, &stmt, NULL);
-
-    sqlite3_bind_text(stmt, 1, argument.c_str(), -1, SQLITE_STATIC);
-
-    // Fetch results
-    while(true)
-    {
-        result =
-        sqlite3_step(stmt);
-
-        if(result == SQLITE_ROW)
-        {
-            // Store results
-            std::string s = (const char*) sqlite3_column_text(stmt, 0);
-            directories.push_back(s);
-        }
-        else    // End or error
-        {
-            sqlite3_finalize(stmt);
-
-            if(result == SQLITE_DONE)
-            {
-                break;
-            }
-            else
-            {
-                msg(INFO, "Error while listing contents!", NEXT_PARAGRAPH);
-
-                return false;
-            }
-        }
-    }
-
-    // Sort and print results
-    sort(directories.begin(), directories.end());
-
-    foreach(std::string directory, directories)
-    {
-        std::cout << directory << std::endl;
-    }
+    database->list_files(argument.c_str(), true);
+    print->output();
 
     return true;
 }
@@ -684,55 +990,17 @@ DDB::list_directories(void)
 bool
 DDB::list_files(void)
 {
-    const char* list_files =
-        "SELECT directory,file FROM ddb WHERE disc LIKE ?";
-    int result;
-    sqlite3_stmt* stmt;
-    std::vector<std::string> files;
-
-    sqlite3_prepare_v2(db, list_files, -1, &stmt, NULL);
-
-    sqlite3_bind_text(stmt, 1, argument.c_str(), -1, SQLITE_STATIC);
-
-    // Fetch results
-    while(true)
-    {
-        result =
-        sqlite3_step(stmt);
-
-        if(result == SQLITE_ROW)
-        {
-            // Store results
-            std::string path;
-            path.append((const char*) sqlite3_column_text(stmt, 0));
-            path.push_back('/');
-            path.append((const char*) sqlite3_column_text(stmt, 1));
-            files.push_back(path);
-        }
-        else    // End or error
-        {
-            sqlite3_finalize(stmt);
+    database->list_files(argument.c_str(), false);
+    print->output();
 
-            if(result == SQLITE_DONE)
-            {
-                break;
-            }
-            else
-            {
-                msg(INFO, "Error while listing contents!", NEXT_PARAGRAPH);
-
-                return false;
-            }
-        }
-    }
-
-    // Sort and print results
-    sort(files.begin(), files.end());
+    return true;
+}
 
-    foreach(std::string file, files)
-    {
-        std::cout << file << std::endl;
-    }
+bool
+DDB::list_duplicates(void)
+{
+    database->find_duplicates();
+    print->output();
 
     return true;
 }
@@ -740,23 +1008,8 @@ DDB::list_files(void)
 bool
 DDB::initialize_database(void)
 {
-    char* error_message = NULL;
-
-    // Create the table
-    int result =
-    sqlite3_exec(db, discdb_schema, NULL, NULL, &error_message);
-
-    if(result != SQLITE_OK)
-    {
-        msg(INFO, "Error creating table!", NEXT_PARAGRAPH);
-
-        sqlite3_free(error_message);
-
-        return false;
-    }
-
-    // Check the table again
-    if(!is_discdb())
+    // Tables were created while opening, check them again
+    if(!database->has_correct_format())
     {
         msg(INFO, "Table was not created!", NEXT_PARAGRAPH);
 
@@ -767,86 +1020,90 @@ DDB::initialize_database(void)
 }
 
 bool
-DDB::search_text(void)
+DDB::upgrade_database(void)
 {
-    const char* search = directories_only ?
-        "SELECT disc,directory,file FROM ddb WHERE directory LIKE ?" :
-        "SELECT disc,directory,file FROM ddb WHERE file LIKE ?";
-    int result;
-    sqlite3_stmt* stmt;
-    std::vector<std::pair<std::string, std::string> > files;
-
-    sqlite3_prepare_v2(db, search, -1, &stmt, NULL);
+    msg(INFO, "Upgrading database " + db_filename + " to the current format...");
 
-    // Create query with wildcards
-    std::string wildcard = "%" + argument + "%";
+    database->upgrade();
 
-    // Bind the query
-    sqlite3_bind_text(stmt, 1, wildcard.c_str(), -1, SQLITE_STATIC);
+    return database->has_correct_format();
+}
 
-    // Fetch results
-    while(true)
-    {
-        result =
-        sqlite3_step(stmt);
+bool
+DDB::create_index(void)
+{
+    msg(VERBOSE, "Creating substring search index...");
 
-        if(result == SQLITE_ROW)
-        {
-            // Store results
-            std::string disc = (const char*) sqlite3_column_text(stmt, 0);
-            std::string absolute_path = (const char*) sqlite3_column_text(stmt, 1);
-                        absolute_path.push_back('/');
-                        absolute_path.append((const char*) sqlite3_column_text(stmt, 2));
+    database->create_search_index();
 
-            files.push_back(make_pair(disc, absolute_path));
-        }
-        else    // End or error
-        {
-            sqlite3_finalize(stmt);
-
-            if(result == SQLITE_DONE)
-            {
-                break;
-            }
-            else
-            {
-                msg(INFO, "Error while listing contents!", NEXT_PARAGRAPH);
+    return database->has_search_index();
+}
 
-                return false;
-            }
-        }
+bool
+DDB::search_text(void)
+{
+    if(glob || regex)
+    {
+        Matcher matcher(argument.c_str(), glob ? Matcher::GLOB : Matcher::REGEX);
+        database->search_text(argument.c_str(), directories_only, jobs, &matcher);
     }
-
-    // Sort and print results
-    sort(files.begin(), files.end());
-
-    std::pair<std::string, std::string> discfile;
-    foreach(discfile, files)
+    else
     {
-        std::cout << discfile.first << ":\t" << discfile.second << std::endl;
+        database->search_text(argument.c_str(), directories_only, jobs);
     }
 
+    print->output();
+
     return true;
 }
 
 void
-DDB::print_help(void)
+DDB::print_help(std::ostream& out)
 {
-    std::cerr << "Disc Data Base" << std::endl
+    out       << "Disc Data Base" << std::endl
               << std::endl
               << "ddb [options] [file ...]" << std::endl
               << std::endl
               << "  Options:" << std::endl
               << "  No options                        Search file(s)" << std::endl
               << "  -a, --add title disc_directory    Add disc to the database" << std::endl
+              << "  -b, --batch N                     Insert N files per statement" << std::endl
+              << "  -B, --bulk                        Add disc with relaxed durability; into a catalog" << std::endl
+              << "                                    without files, build the index at the end" << std::endl
+              << "  -c, --commit N                    Commit every N files, 0 for once" << std::endl
               << "  -d, --directory                   Directories only" << std::endl
+              << "  -g, --glob                        Search names matching a glob like IMG_2019*.jpg" << std::endl
+              << "  -e, --regex                       Search names matching a regular expression" << std::endl
+              << "  -D, --duplicates                  List files stored on more than one disc" << std::endl
+              << "  -H, --hash                        Add disc with digests of file contents" << std::endl
               << "  -r, --remove title                Remove disc from database" << std::endl
+              << "  -y, --yes                         With -r, remove without asking" << std::endl
+              << "  -U, --update title disc_directory Update disc from its directory" << std::endl
+              << "  -u, --upgrade                     Upgrade database to the current format" << std::endl
               << "  -l, --list                        List the given disc or directory" << std::endl
+              << "  -n, --limit N                     Print at most N results" << std::endl
+              << "  -F, --format F                    Print results as text, nul, tsv, jsonl or binary" << std::endl
               << "  -h, --help                        Print this help message" << std::endl
               << "  -v, --verbose                     Increase verbosity" << std::endl
               << "  -q, --quiet                       Decrease verbosity" << std::endl
               << "  -f, --file                        Use another database file" << std::endl
-              << "  -i, --initialize                  Create new database" << std::endl;
+              << "  -i, --initialize                  Create new database" << std::endl
+              << "  -x, --index                       Create substring and prefix search indexes" << std::endl
+              << "  -j, --jobs N                      Walk the disc or search with N threads" << std::endl
+              << "  -A, --fold-accents                With -i or -u, let searches ignore accents too" << std::endl
+              << "  -P, --partitioned                 With -i, keep each disc in a file of its own" << std::endl
+              << "  -m, --metadata                    Store size, time and type of files; with -U," << std::endl
+              << "                                    do not read directories unchanged since then" << std::endl
+              << "  -S, --serve socket                Keep the database open and answer searches" << std::endl
+              << "                                    and listings sent to the socket" << std::endl
+              << "  -M, --memory                      With -S, serve from a copy in memory" << std::endl
+              << "  -C, --connect socket              Send the request to a server instead" << std::endl
+              << "  -E, --export-snapshot file        Write the catalog as read-only snapshot" << std::endl
+              << "  -s, --snapshot file               Search and list in a snapshot" << std::endl
+              << "  -X, --explain                     Report unexpected scans of files or directories and" << std::endl
+              << "                                    fail on them; with -v, all scans and sorts" << std::endl
+              << "  -t, --stats[=json]                Print the time of each phase and counters" << std::endl
+              << "                                    of rows, bytes and SQLite work at the end" << std::endl;
 }
 
 void
@@ -854,10 +1111,10 @@ DDB::msg(enum msg_verbosity min_verbosity, const char* message, enum text_distan
 {
     if(verbosity >= min_verbosity)
     {
-        std::cerr << message;
+        *err << message;
 
         for(int i = 0; i < newlines; i++)
-            std::cerr << std::endl;
+            *err << std::endl;
     }
 }
 
@@ -16,17 +16,19 @@
 #define DDB_HPP
 
 #include <exception>
+#include <iostream>
 #include <string>
+#include <vector>
 
-#include "sqlite3.h"
+#include "db.hpp"
+#include "explain.hpp"
+#include "print.hpp"
+#include "stats.hpp"
 
 
 // Name of the database
 #define DATABASE_NAME "discdb"
 
-// Name of the table
-#define TABLE_NAME "ddb"
-
 
 class DDBError : public std::exception
 {
@@ -73,77 +75,92 @@ enum text_distance
     NEXT_PARAGRAPH = 2
 };
 
-enum database_version
-{
-    UNDEFINED = 0,
-    BASIC = 1,
-    FAST = 2
-};
-
-class DatabaseStrategy
-{
-public:
-    virtual bool disc_present(std::string& disc_name) const = 0;
-    virtual void initialize_database(void) const = 0;
-    virtual void add_disc(std::string& disc_name, std::string& disc_directory) const = 0;
-    virtual void remove_disc(std::string& disc_name) const = 0;
-    virtual void list_discs(void) const = 0;
-    virtual void list_files(std::string& disc_name, std::string& name, bool directories_only) const = 0;
-};
-
-class BasicDatabaseStrategy : virtual public DatabaseStrategy
-{
-public:
-    virtual bool disc_present(std::string& disc_name);
-    virtual void initialize_database(void);
-    virtual void add_disc(std::string& disc_name, std::string& disc_directory);
-    virtual void remove_disc(std::string& disc_name);
-    virtual void list_discs(void);
-    virtual void list_files(std::string& disc_name, std::string& name, bool directories_only);
-};
-
 class DDB
 {
 public:
     DDB(int argc, char** argv);
     ~DDB(void);
     void run(void) throw (DDBError);
-    // Constants
-    const static char* discdb_schema;
 private:
-    bool is_discdb(void);
-    bool is_disc_present(std::string& name);
+    // Request answered by a server, using its open database
+    DDB(DB* database, std::ostream& out, std::ostream& err);
+    void parse(int argc, char** argv);
+    void dispatch(void) throw (DDBError, DBError);
+    void serve(void) throw (DDBError, DBError);
+    std::string answer(const std::string& request);
+    bool respond(int argc, char** argv);
+    void send_request(void) throw (DDBError);
     inline bool add_disc(void);
+    inline bool update_disc(void);
     inline bool remove_disc(void);
     inline bool list_contents(void);
     inline bool list_discs(void);
     inline bool list_directories(void);
     inline bool list_files(void);
+    inline bool list_duplicates(void);
+    inline bool export_snapshot(void);
+    void read_snapshot(void) throw (DDBError);
     inline bool initialize_database(void);
+    inline bool upgrade_database(void);
+    inline bool create_index(void);
     inline bool search_text(void);
-    static void print_help(void);
+    static void print_help(std::ostream& out = std::cerr);
     void msg(enum msg_verbosity min_verbosity, const char* message, enum text_distance = NEXT_LINE);
     void msg(enum msg_verbosity min_verbosity, const std::string& message, enum text_distance = NEXT_LINE);
-    // Database handle
-    sqlite3* db;
+    // Printer
+    Print* print;
+    // Database
+    DB* database;
+    // Statistics of the run, with --stats
+    Stats* stats;
+    // Query plans of the run, with --explain
+    Explainer* explainer;
+    // The database belongs to a server
+    bool shared_database;
+    // Streams for results and for messages
+    std::ostream* out;
+    std::ostream* err;
     // Configuration flags
     std::string db_filename;
     std::string disc_name;
     std::string argument;
+    // Arguments without the program name, sent to a server
+    std::vector<std::string> arguments;
+    std::string serve_socket;
+    std::string connect_socket;
+    std::string export_filename;
+    std::string snapshot_filename;
     bool do_initialize;
     bool do_add;
     bool do_list;
     bool do_remove;
+    bool do_update;
+    bool do_upgrade;
+    bool do_index;
+    bool bulk_load;
+    bool metadata;
+    bool hash_contents;
+    bool fold_accents;
+    bool partitioned;
+    bool do_duplicates;
+    bool assume_yes;
+    bool do_stats;
+    bool json_stats;
+    bool do_explain;
+    bool do_help;
+    bool bad_usage;
+    bool in_memory;
     bool directories_only;
+    // Search with a pattern instead of a text
+    bool glob;
+    bool regex;
+    unsigned int jobs;
+    unsigned long limit;
+    enum Print::Format format;
+    size_t rows_per_insert;
+    size_t rows_per_commit;
     int verbosity;
 };
 
 
-// discdb schema
-const char* DDB::discdb_schema =
-    "CREATE TABLE "TABLE_NAME" "
-    "(directory TEXT NOT NULL, file TEXT, disc TEXT NOT NULL)";
-
-
-
 #endif /* DDB_HPP */
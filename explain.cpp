@@ -0,0 +1,149 @@
+/**
+ *  explain.cpp
+ *
+ *  Query plan diagnostics part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#include "explain.hpp"
+
+#include <cstring>
+
+
+// Tables growing with the catalog, which must not be scanned by accident
+static const char* LARGE_TABLES[] = { "files", "dirs" };
+
+
+Explainer::Explainer(void)
+{
+}
+
+void
+Explainer::explain(sqlite3* db, const char* sql, bool full_scan)
+{
+    if(!explained.insert(sql).second)
+        return;
+
+    std::string query = std::string("EXPLAIN QUERY PLAN ") + sql;
+
+    sqlite3_stmt* stmt;
+
+    // Some statements have no plan to explain
+    if(sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, NULL) != SQLITE_OK)
+    {
+        sqlite3_finalize(stmt);
+        return;
+    }
+
+    Plan plan;
+    plan.sql = sql;
+    plan.scans = false;
+    plan.regression = false;
+
+    // Rows are id, parent, unused and the description of the step
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        const char* step = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
+
+        if(step == NULL)
+            continue;
+
+        if(strncmp(step, "USE TEMP B-TREE", 15) == 0)
+        {
+            plan.steps.push_back(step);
+            continue;
+        }
+
+        if(strncmp(step, "SCAN ", 5) != 0 || strstr(step, "VIRTUAL TABLE") != NULL)
+            continue;
+
+        // Older versions of SQLite say SCAN TABLE
+        const char* object = step + 5;
+
+        if(strncmp(object, "TABLE ", 6) == 0)
+            object += 6;
+
+        std::string name(object, strcspn(object, " "));
+
+        // Attached catalogs name their schema first
+        if(name.find('.') != std::string::npos)
+            name.erase(0, name.find('.') + 1);
+
+        // Subqueries and common table expressions are no tables
+        if(!is_table(db, name))
+            continue;
+
+        plan.steps.push_back(step);
+        plan.scans = true;
+
+        for(size_t i = 0; i < sizeof(LARGE_TABLES) / sizeof(LARGE_TABLES[0]); i++)
+        {
+            if(name == LARGE_TABLES[i] && !full_scan)
+                plan.regression = true;
+        }
+    }
+
+    sqlite3_finalize(stmt);
+
+    if(!plan.steps.empty())
+        plans.push_back(plan);
+}
+
+unsigned long
+Explainer::report(std::ostream& out, bool details) const
+{
+    unsigned long scans = 0;
+    unsigned long regressions = 0;
+
+    for(size_t i = 0; i < plans.size(); i++)
+    {
+        const Plan& plan = plans[i];
+
+        scans += plan.scans ? 1 : 0;
+        regressions += plan.regression ? 1 : 0;
+
+        // Expected scans and sorts are listed only on request
+        if(!plan.regression && !details)
+            continue;
+
+        out << (plan.regression ? "regression" : plan.scans ? "scan" : "sort") << ":\t" << plan.sql << std::endl;
+
+        for(size_t j = 0; j < plan.steps.size(); j++)
+            out << "\t" << plan.steps[j] << std::endl;
+    }
+
+    out << "Explained " << explained.size() << " statements: " << scans << " scan tables, "
+        << plans.size() - scans << " only sort, " << regressions << " scan files or directories unexpectedly" << std::endl;
+
+    return regressions;
+}
+
+bool
+Explainer::is_table(sqlite3* db, const std::string& name)
+{
+    const char* table_query = "SELECT 1 FROM sqlite_master WHERE type='table' AND name=?1 "
+                              "UNION ALL SELECT 1 FROM sqlite_temp_master WHERE type='table' AND name=?1";
+
+    sqlite3_stmt* stmt;
+
+    if(sqlite3_prepare_v2(db, table_query, -1, &stmt, NULL) != SQLITE_OK)
+    {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+
+    sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
+
+    bool found = (sqlite3_step(stmt) == SQLITE_ROW);
+
+    sqlite3_finalize(stmt);
+
+    return found;
+}
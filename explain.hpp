@@ -0,0 +1,55 @@
+/**
+ *  explain.hpp
+ *
+ *  Query plan diagnostics include part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#ifndef EXPLAIN_HPP
+#define EXPLAIN_HPP
+
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "sqlite3.h"
+
+
+/*
+ * Asks SQLite for the plan of each statement once, before it first runs,
+ * and notes the tables it scans in full and the temporary B-trees it
+ * builds for DISTINCT, ORDER BY or GROUP BY. Files and directories grow
+ * with the catalog, so a full scan of them is a regression unless the
+ * statement is meant to read them all.
+ */
+class Explainer
+{
+public:
+    Explainer(void);
+    void explain(sqlite3* db, const char* sql, bool full_scan = false);
+    // Lists the regressions, with details all statements with scans or temporary B-trees,
+    // and sums them up; returns the number of regressions
+    unsigned long report(std::ostream& out, bool details) const;
+private:
+    struct Plan
+    {
+        std::string sql;
+        // Steps scanning tables or sorting in temporary B-trees
+        std::vector<std::string> steps;
+        bool scans;
+        bool regression;
+    };
+    static bool is_table(sqlite3* db, const std::string& name);
+    std::set<std::string> explained;
+    std::vector<Plan> plans;
+};
+
+#endif /* EXPLAIN_HPP */
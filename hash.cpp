@@ -0,0 +1,347 @@
+/**
+ *  hash.cpp
+ *
+ *  Content hashing part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#include "hash.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <boost/foreach.hpp>
+
+// Use shortcut from example
+#define foreach BOOST_FOREACH
+
+// Use a shortcut
+namespace fs = boost::filesystem;
+
+
+static const boost::uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const boost::uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const boost::uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const boost::uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const boost::uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+// Size of the reads while hashing files
+static const size_t READ_SIZE = 1 << 20;
+
+// Entries taken from the walker at once by each hashing thread
+static const size_t HASH_BATCH = 16;
+
+static inline boost::uint64_t
+rotate_left(boost::uint64_t x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+// Little endian reads, whatever the byte order of the machine
+static inline boost::uint64_t
+read64(const unsigned char* p)
+{
+    return  (boost::uint64_t) p[0]        | ((boost::uint64_t) p[1] << 8)  |
+           ((boost::uint64_t) p[2] << 16) | ((boost::uint64_t) p[3] << 24) |
+           ((boost::uint64_t) p[4] << 32) | ((boost::uint64_t) p[5] << 40) |
+           ((boost::uint64_t) p[6] << 48) | ((boost::uint64_t) p[7] << 56);
+}
+
+static inline boost::uint64_t
+read32(const unsigned char* p)
+{
+    return  (boost::uint64_t) p[0]        | ((boost::uint64_t) p[1] << 8) |
+           ((boost::uint64_t) p[2] << 16) | ((boost::uint64_t) p[3] << 24);
+}
+
+static inline boost::uint64_t
+hash_round(boost::uint64_t accumulator, boost::uint64_t input)
+{
+    accumulator += input * PRIME64_2;
+    accumulator = rotate_left(accumulator, 31);
+
+    return accumulator * PRIME64_1;
+}
+
+static inline boost::uint64_t
+merge_round(boost::uint64_t accumulator, boost::uint64_t value)
+{
+    accumulator ^= hash_round(0, value);
+
+    return accumulator * PRIME64_1 + PRIME64_4;
+}
+
+
+Hash64::Hash64(boost::uint64_t seed) :
+    seed(seed), total_length(0), stripe_length(0)
+{
+    v[0] = seed + PRIME64_1 + PRIME64_2;
+    v[1] = seed + PRIME64_2;
+    v[2] = seed;
+    v[3] = seed - PRIME64_1;
+}
+
+void
+Hash64::update(const unsigned char* data, size_t length)
+{
+    total_length += length;
+
+    // Complete a stripe started before
+    if(stripe_length > 0)
+    {
+        size_t missing = sizeof(stripe) - stripe_length;
+
+        if(length < missing)
+        {
+            memcpy(stripe + stripe_length, data, length);
+            stripe_length += length;
+            return;
+        }
+
+        memcpy(stripe + stripe_length, data, missing);
+        data += missing;
+        length -= missing;
+
+        for(int i = 0; i < 4; i++)
+            v[i] = hash_round(v[i], read64(stripe + 8*i));
+
+        stripe_length = 0;
+    }
+
+    // Full stripes straight from the data
+    while(length >= sizeof(stripe))
+    {
+        for(int i = 0; i < 4; i++)
+            v[i] = hash_round(v[i], read64(data + 8*i));
+
+        data += sizeof(stripe);
+        length -= sizeof(stripe);
+    }
+
+    memcpy(stripe, data, length);
+    stripe_length = length;
+}
+
+boost::uint64_t
+Hash64::digest(void) const
+{
+    boost::uint64_t h;
+
+    if(total_length >= sizeof(stripe))
+    {
+        h = rotate_left(v[0], 1) + rotate_left(v[1], 7) + rotate_left(v[2], 12) + rotate_left(v[3], 18);
+
+        for(int i = 0; i < 4; i++)
+            h = merge_round(h, v[i]);
+    }
+    else
+    {
+        h = seed + PRIME64_5;
+    }
+
+    h += total_length;
+
+    // Fold in the rest of the input
+    const unsigned char* p = stripe;
+    size_t length = stripe_length;
+
+    while(length >= 8)
+    {
+        h ^= hash_round(0, read64(p));
+        h = rotate_left(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+        length -= 8;
+    }
+
+    if(length >= 4)
+    {
+        h ^= read32(p) * PRIME64_1;
+        h = rotate_left(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+        length -= 4;
+    }
+
+    while(length > 0)
+    {
+        h ^= (*p) * PRIME64_5;
+        h = rotate_left(h, 11) * PRIME64_1;
+        p++;
+        length--;
+    }
+
+    // Final avalanche
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+
+#ifdef _WIN32
+
+bool
+hash_file(const std::string& path, unsigned char* buffer, size_t buffer_size, boost::uint64_t& digest)
+{
+    Hash64 hash;
+    size_t length;
+
+    FILE* file = fopen(path.c_str(), "rb");
+
+    if(file == NULL)
+        return false;
+
+    // The buffer is large enough, avoid copying through another one
+    setvbuf(file, NULL, _IONBF, 0);
+
+    while((length = fread(buffer, 1, buffer_size, file)) > 0)
+        hash.update(buffer, length);
+
+    bool success = !ferror(file);
+    fclose(file);
+
+    digest = hash.digest();
+
+    return success;
+}
+
+#else
+
+bool
+hash_file(const std::string& path, unsigned char* buffer, size_t buffer_size, boost::uint64_t& digest)
+{
+    Hash64 hash;
+    ssize_t length;
+
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if(fd < 0)
+        return false;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    // Let the kernel read ahead generously
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    while((length = read(fd, buffer, buffer_size)) != 0)
+    {
+        if(length < 0)
+        {
+            if(errno == EINTR)
+                continue;
+
+            close(fd);
+            return false;
+        }
+
+        hash.update(buffer, length);
+    }
+
+    close(fd);
+
+    digest = hash.digest();
+
+    return true;
+}
+
+#endif /* _WIN32 */
+
+
+Hasher::Hasher(EntryQueue& input, EntryQueue& output, unsigned int jobs) :
+    in(&input), out(&output), jobs(jobs), failures(0)
+{
+}
+
+void
+Hasher::run(void)
+{
+    boost::thread_group workers;
+
+    for(unsigned int i = 0; i < jobs; i++)
+        workers.add_thread(new boost::thread(&Hasher::work, this));
+
+    workers.join_all();
+
+    if(in->failed())
+        out->fail(in->get_error());
+    else
+        out->finish();
+}
+
+unsigned long
+Hasher::get_failures(void)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    return failures;
+}
+
+void
+Hasher::work(void)
+{
+    std::vector<Entry> batch;
+    unsigned long failed = 0;
+
+    // Page aligned reads are the cheapest to serve
+    void* memory = NULL;
+
+#ifdef _WIN32
+    memory = malloc(READ_SIZE);
+#else
+    if(posix_memalign(&memory, 4096, READ_SIZE) != 0)
+        memory = NULL;
+#endif
+
+    unsigned char* buffer = static_cast<unsigned char*>(memory);
+
+    while(in->pop(batch, HASH_BATCH) > 0)
+    {
+        foreach(Entry& entry, batch)
+        {
+            // Only regular files have contents worth comparing
+            if(entry.is_directory || !entry.has_metadata || entry.type != 'f')
+                continue;
+
+            if(buffer == NULL)
+            {
+                failed++;
+                continue;
+            }
+
+            std::string path = (fs::path(entry.directory) / entry.file).string();
+
+            entry.has_hash = hash_file(path, buffer, READ_SIZE, entry.hash);
+
+            if(!entry.has_hash)
+                failed++;
+        }
+
+        // Stop the walker if the inserter gave up
+        if(!out->push_all(batch))
+        {
+            in->cancel();
+            break;
+        }
+    }
+
+    free(memory);
+
+    boost::mutex::scoped_lock lock(mutex);
+    failures += failed;
+}
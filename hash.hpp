@@ -0,0 +1,66 @@
+/**
+ *  hash.hpp
+ *
+ *  Content hashing include part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+
+#include "walk.hpp"
+
+
+// Incremental 64 bit hash, compatible with XXH64
+class Hash64
+{
+public:
+    Hash64(boost::uint64_t seed = 0);
+    void update(const unsigned char* data, size_t length);
+    boost::uint64_t digest(void) const;
+private:
+    boost::uint64_t v[4];
+    boost::uint64_t seed;
+    boost::uint64_t total_length;
+    // Input not yet making up a full stripe
+    unsigned char stripe[32];
+    size_t stripe_length;
+};
+
+// Hash the contents of a file; returns false if it cannot be read
+bool hash_file(const std::string& path, unsigned char* buffer, size_t buffer_size, boost::uint64_t& digest);
+
+/*
+ * Hashing stage between the walker and the database inserter. Several
+ * threads take entries from the walker, hash the files among them and
+ * pass everything on. Entries may leave in another order than they came.
+ */
+class Hasher
+{
+public:
+    Hasher(EntryQueue& input, EntryQueue& output, unsigned int jobs = 1);
+    void run(void);
+    // Files which could not be read
+    unsigned long get_failures(void);
+private:
+    void work(void);
+    EntryQueue* in;
+    EntryQueue* out;
+    unsigned int jobs;
+    boost::mutex mutex;
+    unsigned long failures;
+};
+
+#endif /* HASH_HPP */
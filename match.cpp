@@ -0,0 +1,387 @@
+/**
+ *  match.cpp
+ *
+ *  Pattern matching part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#include "match.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+
+// Characters with a meaning in regular expressions
+static const char* REGEX_SPECIAL = ".[]{}()\\*+?|^$";
+
+// One UTF-8 character, like ? of GLOB in SQLite
+static const char* ANY_CHARACTER = "[^\\x80-\\xbf][\\x80-\\xbf]*";
+
+// Largest code point of the UTF-8 characters of one to four bytes
+static const unsigned long LARGEST_CODE_POINT[] = { 0x7f, 0x7ff, 0xffff, 0x10ffff };
+
+
+// Byte written for the regular expression, where it has no other meaning
+static std::string
+escaped_byte(unsigned char byte)
+{
+    char text[8];
+
+    snprintf(text, sizeof(text), "\\x%02x", byte);
+
+    return text;
+}
+
+static std::string
+encoded(unsigned long code_point)
+{
+    std::string bytes;
+
+    if(code_point <= LARGEST_CODE_POINT[0])
+    {
+        bytes.push_back(static_cast<char>(code_point));
+    }
+    else if(code_point <= LARGEST_CODE_POINT[1])
+    {
+        bytes.push_back(static_cast<char>(0xc0 | (code_point >> 6)));
+        bytes.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+    }
+    else if(code_point <= LARGEST_CODE_POINT[2])
+    {
+        bytes.push_back(static_cast<char>(0xe0 | (code_point >> 12)));
+        bytes.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+        bytes.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+    }
+    else
+    {
+        bytes.push_back(static_cast<char>(0xf0 | (code_point >> 18)));
+        bytes.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3f)));
+        bytes.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+        bytes.push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+    }
+
+    return bytes;
+}
+
+/*
+ * Reads the UTF-8 character at c, ending before end, and returns its
+ * length; a byte not starting a valid character is read on its own.
+ */
+static size_t
+read_character(const char* c, const char* end, unsigned long& code_point, bool& valid)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(c);
+
+    size_t length = (bytes[0] < 0x80) ? 1 :
+                    (bytes[0] >= 0xc2 && bytes[0] <= 0xdf) ? 2 :
+                    (bytes[0] >= 0xe0 && bytes[0] <= 0xef) ? 3 :
+                    (bytes[0] >= 0xf0 && bytes[0] <= 0xf4) ? 4 : 0;
+
+    code_point = bytes[0];
+    valid = false;
+
+    if(length == 0 || c + length > end)
+        return 1;
+
+    if(length > 1)
+        code_point &= 0x3f >> (length - 1);
+
+    for(size_t i = 1; i < length; i++)
+    {
+        if((bytes[i] & 0xc0) != 0x80)
+            return 1;
+
+        code_point = (code_point << 6) | (bytes[i] & 0x3f);
+    }
+
+    // Overlong forms and code points beyond Unicode are no characters
+    if(code_point > LARGEST_CODE_POINT[3] || (length > 1 && code_point <= LARGEST_CODE_POINT[length - 2]))
+        return 1;
+
+    valid = true;
+
+    return length;
+}
+
+/*
+ * Adds the byte sequences of the characters from low to high, all of the
+ * same length, to the alternatives. The range is split until each byte
+ * of its sequences may take any value between those of its ends.
+ */
+static void
+add_sequences(unsigned long low, unsigned long high, std::vector<std::string>& alternatives)
+{
+    std::string low_bytes = encoded(low);
+
+    for(size_t i = 1; i < low_bytes.length(); i++)
+    {
+        // Code points with the same leading bytes differ in the bits of the last i bytes
+        unsigned long last = (1UL << (6 * i)) - 1;
+
+        if((low & ~last) == (high & ~last))
+            continue;
+
+        if((low & last) != 0)
+        {
+            add_sequences(low, low | last, alternatives);
+            add_sequences((low | last) + 1, high, alternatives);
+            return;
+        }
+
+        if((high & last) != last)
+        {
+            add_sequences(low, (high & ~last) - 1, alternatives);
+            add_sequences(high & ~last, high, alternatives);
+            return;
+        }
+    }
+
+    std::string high_bytes = encoded(high);
+    std::string sequence;
+
+    for(size_t i = 0; i < low_bytes.length(); i++)
+    {
+        unsigned char low_byte = static_cast<unsigned char>(low_bytes[i]);
+        unsigned char high_byte = static_cast<unsigned char>(high_bytes[i]);
+
+        if(low_byte == high_byte)
+            sequence.append(escaped_byte(low_byte));
+        else
+            sequence.append("[" + escaped_byte(low_byte) + "-" + escaped_byte(high_byte) + "]");
+    }
+
+    alternatives.push_back(sequence);
+}
+
+// Adds the characters from low to high, single bytes to the set and longer ones to the alternatives
+static void
+add_range(unsigned long low, unsigned long high, std::string& set, std::vector<std::string>& alternatives)
+{
+    unsigned long start = 0;
+
+    for(size_t i = 0; i < sizeof(LARGEST_CODE_POINT) / sizeof(LARGEST_CODE_POINT[0]); i++)
+    {
+        unsigned long from = std::max(low, start);
+        unsigned long to = std::min(high, LARGEST_CODE_POINT[i]);
+
+        start = LARGEST_CODE_POINT[i] + 1;
+
+        if(from > to)
+            continue;
+
+        if(i > 0)
+        {
+            add_sequences(from, to, alternatives);
+            continue;
+        }
+
+        set.append(escaped_byte(from));
+
+        if(to > from)
+            set.append("-" + escaped_byte(to));
+    }
+}
+
+/*
+ * Regular expression matching one character of a class of a glob, given
+ * by the text between [ or [^ and ]. Like GLOB of SQLite, a - between
+ * two characters makes a range of code points, elsewhere it stands for
+ * itself. A class matches a whole UTF-8 character, even when negated.
+ */
+static std::string
+class_expression(const char* c, const char* end, bool negated)
+{
+    std::string set;
+    std::vector<std::string> alternatives;
+
+    while(c < end)
+    {
+        unsigned long low;
+        bool valid;
+
+        const char* next = c + read_character(c, end, low, valid);
+
+        if(!valid)
+        {
+            alternatives.push_back(escaped_byte(static_cast<unsigned char>(*c)));
+            c = next;
+            continue;
+        }
+
+        unsigned long high = low;
+        bool high_valid = false;
+
+        if(next + 1 < end && *next == '-')
+        {
+            const char* after = next + 1 + read_character(next + 1, end, high, high_valid);
+
+            if(high_valid)
+                next = after;
+        }
+
+        // SQLite takes the start of a range running backwards for itself
+        if(!high_valid || high < low)
+            high = low;
+
+        add_range(low, high, set, alternatives);
+        c = next;
+    }
+
+    std::string members = set.empty() ? "" : "[" + set + "]";
+
+    for(size_t i = 0; i < alternatives.size(); i++)
+        members.append((members.empty() ? "" : "|") + alternatives[i]);
+
+    if(negated)
+        return "(?!" + members + ")" + ANY_CHARACTER;
+
+    return "(?:" + members + ")";
+}
+
+
+Matcher::Matcher(const char* pattern, Syntax syntax) throw(DBError) :
+    whole(syntax == GLOB)
+{
+    std::string source;
+
+    if(syntax == GLOB)
+    {
+        source = glob_expression(pattern, prefix);
+    }
+    else
+    {
+        source = pattern;
+        prefix = regex_prefix(pattern);
+    }
+
+    try
+    {
+        expression.assign(source, boost::regex::perl);
+    }
+    catch(boost::regex_error& e)
+    {
+        throw(DBError(std::string("Invalid pattern ") + pattern + ": " + e.what(), DBError::WARNING));
+    }
+
+    // Drop the characters that can not be incremented, then increment the last one
+    prefix_end = prefix;
+
+    while(!prefix_end.empty() && static_cast<unsigned char>(prefix_end[prefix_end.length()-1]) == 0xff)
+        prefix_end.erase(prefix_end.length() - 1);
+
+    if(!prefix_end.empty())
+        prefix_end[prefix_end.length()-1]++;
+}
+
+bool
+Matcher::matches(const char* text, size_t length) const
+{
+    if(whole)
+        return boost::regex_match(text, text + length, expression);
+
+    // Names may contain new lines, ^ is only their start
+    return boost::regex_search(text, text + length, expression, boost::match_single_line);
+}
+
+const std::string&
+Matcher::get_prefix(void) const
+{
+    return prefix;
+}
+
+const std::string&
+Matcher::get_prefix_end(void) const
+{
+    return prefix_end;
+}
+
+// Regular expression matching what a glob matches, with * ? and [...] like GLOB of SQLite
+std::string
+Matcher::glob_expression(const char* pattern, std::string& prefix)
+{
+    std::string expression;
+
+    bool literal = true;
+
+    prefix.clear();
+
+    for(const char* c = pattern; *c != '\0'; c++)
+    {
+        // A ] right after [ or [^ belongs to the class, an unclosed [ stands for itself
+        const char* class_end = NULL;
+
+        if(*c == '[')
+        {
+            const char* members = c + 1;
+
+            if(*members == '^' || *members == '!')
+                members++;
+
+            class_end = strchr(*members == ']' ? members + 1 : members, ']');
+        }
+
+        if(*c == '*' || *c == '?' || class_end != NULL)
+            literal = false;
+
+        if(*c == '*')
+        {
+            expression.append(".*");
+        }
+        else if(*c == '?')
+        {
+            expression.append(ANY_CHARACTER);
+        }
+        else if(class_end != NULL)
+        {
+            bool negated = (c[1] == '^' || c[1] == '!');
+
+            expression.append(class_expression(c + (negated ? 2 : 1), class_end, negated));
+
+            c = class_end;
+        }
+        else
+        {
+            if(strchr(REGEX_SPECIAL, *c) != NULL)
+                expression.push_back('\\');
+
+            expression.push_back(*c);
+
+            if(literal)
+                prefix.push_back(*c);
+        }
+    }
+
+    return expression;
+}
+
+// Literal text after ^ at the start of a regular expression
+std::string
+Matcher::regex_prefix(const char* pattern)
+{
+    std::string prefix;
+
+    // Alternatives may start with anything
+    if(pattern[0] != '^' || strchr(pattern, '|') != NULL)
+        return prefix;
+
+    const char* c = pattern + 1;
+
+    while(*c != '\0' && strchr(REGEX_SPECIAL, *c) == NULL)
+        prefix.push_back(*c++);
+
+    // The last character may be left out or repeated
+    if(!prefix.empty() && (*c == '*' || *c == '?' || *c == '{'))
+        prefix.erase(prefix.length() - 1);
+
+    return prefix;
+}
@@ -0,0 +1,55 @@
+/**
+ *  match.hpp
+ *
+ *  Pattern matching include part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#ifndef MATCH_HPP
+#define MATCH_HPP
+
+#include <iostream>
+#include <string>
+
+#include <boost/regex.hpp>
+
+#include "error.hpp"
+
+/*
+ * A glob or regular expression, compiled once for a whole search. Globs
+ * must match the whole name, regular expressions any part of it; both
+ * are case sensitive. Matches of a pattern starting with literal text
+ * all start with that text, the prefix, so only the names from the
+ * prefix up to the end of the prefix need to be looked at.
+ */
+class Matcher
+{
+public:
+    enum Syntax
+    {
+        GLOB,
+        REGEX
+    };
+    Matcher(const char* pattern, Syntax syntax) throw(DBError);
+    bool matches(const char* text, size_t length) const;
+    // Text all matches start with, empty if there is none
+    const std::string& get_prefix(void) const;
+    // First text after all texts starting with the prefix, empty if there is none
+    const std::string& get_prefix_end(void) const;
+private:
+    static std::string glob_expression(const char* pattern, std::string& prefix);
+    static std::string regex_prefix(const char* pattern);
+    boost::regex expression;
+    bool whole;
+    std::string prefix;
+    std::string prefix_end;
+};
+
+#endif /* MATCH_HPP */
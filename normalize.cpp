@@ -0,0 +1,139 @@
+/**
+ *  normalize.cpp
+ *
+ *  Name normalization part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#include "normalize.hpp"
+
+#include <boost/locale.hpp>
+
+
+// Length of the UTF-8 character at the given position, 0 if it is not valid
+static size_t
+character_length(const unsigned char* text, size_t length, size_t i)
+{
+    unsigned char c = text[i];
+
+    size_t count = c < 0x80 ? 1 :
+                   (c & 0xe0) == 0xc0 && c >= 0xc2 ? 2 :
+                   (c & 0xf0) == 0xe0 ? 3 :
+                   (c & 0xf8) == 0xf0 && c <= 0xf4 ? 4 : 0;
+
+    if(count == 0 || i + count > length)
+        return 0;
+
+    for(size_t j = 1; j < count; j++)
+    {
+        if((text[i + j] & 0xc0) != 0x80)
+            return 0;
+    }
+
+    return count;
+}
+
+// Code point of a valid UTF-8 character
+static unsigned long
+code_point(const unsigned char* text, size_t count)
+{
+    static const unsigned char first_bits[] = { 0, 0x7f, 0x1f, 0x0f, 0x07 };
+
+    unsigned long point = text[0] & first_bits[count];
+
+    for(size_t j = 1; j < count; j++)
+        point = (point << 6) | (text[j] & 0x3f);
+
+    return point;
+}
+
+// Accents and other marks combined with the character before them
+static bool
+is_combining_mark(unsigned long point)
+{
+    return (point >= 0x0300 && point <= 0x036f) ||
+           (point >= 0x1ab0 && point <= 0x1aff) ||
+           (point >= 0x1dc0 && point <= 0x1dff) ||
+           (point >= 0x20d0 && point <= 0x20ff) ||
+           (point >= 0xfe20 && point <= 0xfe2f);
+}
+
+
+Normalizer::Normalizer(bool fold_accents) :
+    fold_accents(fold_accents)
+{
+    boost::locale::generator generator;
+
+    locale = generator("en_US.UTF-8");
+}
+
+std::string
+Normalizer::key(const char* name, size_t length) const
+{
+    const unsigned char* text = reinterpret_cast<const unsigned char*>(name);
+
+    std::string folded(name, length);
+
+    bool ascii = true;
+    bool valid = true;
+
+    for(size_t i = 0; valid && i < length; )
+    {
+        size_t count = character_length(text, length, i);
+
+        ascii = ascii && count == 1;
+        valid = count > 0;
+
+        i += count;
+    }
+
+    // Most names need nothing more than this
+    if(ascii || !valid)
+    {
+        for(size_t i = 0; i < length; i++)
+        {
+            if(folded[i] >= 'A' && folded[i] <= 'Z')
+                folded[i] = folded[i] - 'A' + 'a';
+        }
+
+        return folded;
+    }
+
+    folded = boost::locale::fold_case(folded, locale);
+
+    if(fold_accents)
+        folded = strip_accents(boost::locale::normalize(folded, boost::locale::norm_nfd, locale));
+
+    return boost::locale::normalize(folded, boost::locale::norm_nfc, locale);
+}
+
+// Text without the combining marks of its characters, which must be decomposed
+std::string
+Normalizer::strip_accents(const std::string& text) const
+{
+    const unsigned char* characters = reinterpret_cast<const unsigned char*>(text.data());
+
+    std::string stripped;
+
+    for(size_t i = 0; i < text.length(); )
+    {
+        size_t count = character_length(characters, text.length(), i);
+
+        if(count == 0)
+            count = 1;
+
+        if(!is_combining_mark(code_point(characters + i, count)))
+            stripped.append(text, i, count);
+
+        i += count;
+    }
+
+    return stripped;
+}
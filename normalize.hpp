@@ -0,0 +1,39 @@
+/**
+ *  normalize.hpp
+ *
+ *  Name normalization include part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#ifndef NORMALIZE_HPP
+#define NORMALIZE_HPP
+
+#include <locale>
+#include <string>
+
+
+/*
+ * Turns names into keys that compare equal whenever the names differ only
+ * in case or in the composition of their characters (NFC versus NFD),
+ * and optionally in accents. Names that are not valid UTF-8 only have
+ * their ASCII letters folded.
+ */
+class Normalizer
+{
+public:
+    Normalizer(bool fold_accents = false);
+    std::string key(const char* name, size_t length) const;
+private:
+    std::string strip_accents(const std::string& text) const;
+    std::locale locale;
+    bool fold_accents;
+};
+
+#endif /* NORMALIZE_HPP */
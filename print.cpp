@@ -13,19 +13,194 @@
  */
 
 #include "print.hpp"
+#include "stats.hpp"
 
-#include <iostream>
-#include <sstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 
-#include <algorithm>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
-#include <boost/foreach.hpp>
+// Size of the output buffer
+static const size_t OUTPUT_BUFFER = 1 << 18;
 
-// Use shortcut from example
-#define foreach BOOST_FOREACH
+// Descriptor of the standard output
+static const int STANDARD_OUTPUT = 1;
 
 
-Print::Print(enum Verbosity verbosity)
+Writer::Writer(int fd) :
+    fd(fd), stream(NULL), buffer(new char[OUTPUT_BUFFER]), capacity(OUTPUT_BUFFER), used(0), error(false), stats(NULL)
+{
+}
+
+Writer::Writer(std::ostream& stream) :
+    fd(-1), stream(&stream), buffer(new char[OUTPUT_BUFFER]), capacity(OUTPUT_BUFFER), used(0), error(false), stats(NULL)
+{
+}
+
+Writer::~Writer()
+{
+    flush();
+
+    delete[] buffer;
+}
+
+void
+Writer::flush(void)
+{
+    write_out(buffer, used);
+    used = 0;
+}
+
+bool
+Writer::failed(void)
+{
+    return error;
+}
+
+void
+Writer::set_stats(Stats* stats)
+{
+    this->stats = stats;
+}
+
+void
+Writer::write_out(const char* data, size_t length)
+{
+    if(error || length == 0)
+        return;
+
+    Stats::Timer timer(stats, "write");
+
+    if(stats != NULL)
+        stats->add_count("output_bytes", length);
+
+    if(stream != NULL)
+    {
+        stream->write(data, length);
+        stream->flush();
+
+        error = stream->fail();
+        return;
+    }
+
+    while(length > 0)
+    {
+        int written = write(fd, data, length);
+
+        if(written < 0 && errno == EINTR)
+            continue;
+
+        if(written <= 0)
+        {
+            error = true;
+            return;
+        }
+
+        data += written;
+        length -= written;
+    }
+}
+
+
+// Length of the valid UTF-8 sequence starting with a byte of 0x80 or more, 0 if it is not valid
+static size_t
+sequence_length(const unsigned char* text, size_t length, size_t i)
+{
+    unsigned char c = text[i];
+
+    size_t count = (c >= 0xc2 && c <= 0xdf) ? 2 :
+                   (c >= 0xe0 && c <= 0xef) ? 3 :
+                   (c >= 0xf0 && c <= 0xf4) ? 4 : 0;
+
+    if(count == 0 || i + count > length)
+        return 0;
+
+    // The second byte rules out overlong forms, surrogates and code points above U+10FFFF
+    unsigned char low = (c == 0xe0) ? 0xa0 : (c == 0xf0) ? 0x90 : 0x80;
+    unsigned char high = (c == 0xed) ? 0x9f : (c == 0xf4) ? 0x8f : 0xbf;
+
+    if(text[i + 1] < low || text[i + 1] > high)
+        return 0;
+
+    for(size_t j = 2; j < count; j++)
+    {
+        if((text[i + j] & 0xc0) != 0x80)
+            return 0;
+    }
+
+    return count;
+}
+
+void
+append_json(Writer& out, const char* text, size_t length)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    // U+FFFD in UTF-8
+    static const char replacement[] = "\xef\xbf\xbd";
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(text);
+
+    // Copy runs of ordinary characters at once
+    size_t start = 0;
+
+    for(size_t i = 0; i < length; )
+    {
+        unsigned char c = bytes[i];
+
+        if(c >= 0x20 && c < 0x80 && c != '\\' && c != '"')
+        {
+            i++;
+            continue;
+        }
+
+        size_t count = (c >= 0x80) ? sequence_length(bytes, length, i) : 1;
+
+        if(c >= 0x80 && count > 0)
+        {
+            i += count;
+            continue;
+        }
+
+        out.append(text + start, i - start);
+
+        if(count == 0)
+        {
+            out.append(replacement, 3);
+        }
+        else if(c == '\\' || c == '"')
+        {
+            out.append('\\');
+            out.append(c);
+        }
+        else
+        {
+            out.append("\\u00", 4);
+            out.append(hex[c >> 4]);
+            out.append(hex[c & 0x0f]);
+        }
+
+        start = ++i;
+    }
+
+    out.append(text + start, length - start);
+}
+
+
+Print::Print(enum Verbosity verbosity) :
+    format(TEXT), out(STANDARD_OUTPUT), limit(0), printed(0), stats(NULL)
+{
+    // Store specified verbosity
+    specified_verbosity = verbosity;
+}
+
+Print::Print(enum Verbosity verbosity, std::ostream& out) :
+    format(TEXT), out(out), limit(0), printed(0), stats(NULL)
 {
     // Store specified verbosity
     specified_verbosity = verbosity;
@@ -41,59 +216,359 @@ Print::get_verbosity(void)
     return specified_verbosity;
 }
 
+void
+Print::set_limit(unsigned long limit)
+{
+    this->limit = limit;
+}
+
+void
+Print::set_format(enum Format format)
+{
+    this->format = format;
+}
+
+void
+Print::set_stats(Stats* stats)
+{
+    this->stats = stats;
+
+    out.set_stats(stats);
+}
+
 void
 Print::msg(const char* text, enum Verbosity message_verbosity)
 {
     // Print message only if its verbosity is at least as severe as the one specified
     if(message_verbosity <= specified_verbosity)
     {
-        std::cout << text << std::endl;
+        // Keep machine readable results clean
+        if(format != TEXT)
+        {
+            std::cerr << text << std::endl;
+            return;
+        }
+
+        out.append(text, strlen(text));
+        out.append('\n');
+        out.flush();
     }
 }
 
-void
-Print::add_disc(const char* disc_name)
+bool
+Print::start_result(void)
+{
+    if(!wants_more())
+        return false;
+
+    // Separate the results from the preceding output
+    if(printed == 0 && format == TEXT)
+        out.append('\n');
+
+    printed++;
+
+    return true;
+}
+
+bool
+Print::wants_more(void)
+{
+    return (limit == 0 || printed < limit) && !out.failed();
+}
+
+bool
+Print::add_disc(const char* disc_name, size_t disc_length)
+{
+    return add_result(NULL, 0, disc_name, disc_length, NULL, 0, NULL, 0);
+}
+
+bool
+Print::add_disc(const char* disc_name, size_t disc_length, unsigned long files, unsigned long directories)
+{
+    // NUL separated output holds names only
+    if(format == NUL)
+        return add_disc(disc_name, disc_length);
+
+    if(!start_result())
+        return false;
+
+    char files_text[24];
+    char directories_text[24];
+
+    snprintf(files_text, sizeof(files_text), "%lu", files);
+    snprintf(directories_text, sizeof(directories_text), "%lu", directories);
+
+    size_t files_length = strlen(files_text);
+    size_t directories_length = strlen(directories_text);
+
+    switch(format)
+    {
+        case TEXT:
+            out.append(disc_name, disc_length);
+            out.append(":\t", 2);
+            out.append(files_text, files_length);
+            out.append(" files, ", 8);
+            out.append(directories_text, directories_length);
+            out.append(" directories\n", 13);
+            break;
+
+        case TSV:
+            append_escaped(disc_name, disc_length);
+            out.append('\t');
+            out.append(files_text, files_length);
+            out.append('\t');
+            out.append(directories_text, directories_length);
+            out.append('\n');
+            break;
+
+        case JSON_LINES:
+            out.append("{\"disc\":\"", 9);
+            append_escaped(disc_name, disc_length);
+            out.append("\",\"files\":", 10);
+            out.append(files_text, files_length);
+            out.append(",\"directories\":", 15);
+            out.append(directories_text, directories_length);
+            out.append("}\n", 2);
+            break;
+
+        case BINARY:
+            out.append(static_cast<char>(3));
+
+            append_length(disc_length);
+            out.append(disc_name, disc_length);
+
+            append_length(files_length);
+            out.append(files_text, files_length);
+
+            append_length(directories_length);
+            out.append(directories_text, directories_length);
+            break;
+
+        default:
+            break;
+    }
+
+    return wants_more();
+}
+
+bool
+Print::add_directory(const char* disc_name, size_t disc_length, const char* directory, size_t directory_length)
+{
+    return add_result(NULL, 0, disc_name, disc_length, directory, directory_length, NULL, 0);
+}
+
+bool
+Print::add_file(const char* disc_name, size_t disc_length, const char* directory, size_t directory_length,
+                const char* file, size_t file_length)
+{
+    return add_result(NULL, 0, disc_name, disc_length, directory, directory_length, file, file_length);
+}
+
+bool
+Print::add_duplicate(const char* group, size_t group_length, const char* disc_name, size_t disc_length,
+                     const char* directory, size_t directory_length, const char* file, size_t file_length)
+{
+    return add_result(group, group_length, disc_name, disc_length, directory, directory_length, file, file_length);
+}
+
+bool
+Print::add_result(const char* group, size_t group_length, const char* disc_name, size_t disc_length,
+                  const char* directory, size_t directory_length, const char* file, size_t file_length)
 {
-    results.push_back(std::string(disc_name));
+    if(!start_result())
+        return false;
+
+    // Path of the result, if it is not a disc
+    size_t path_length = file == NULL ? directory_length : directory_length + 1 + file_length;
+
+    switch(format)
+    {
+        case TEXT:
+            // Lead with the group, so that copies stay recognizable
+            if(group != NULL)
+            {
+                out.append(group, group_length);
+                out.append('\t');
+            }
+
+            out.append(disc_name, disc_length);
+
+            if(directory != NULL)
+            {
+                out.append(":\t", 2);
+                out.append(directory, directory_length);
+            }
+
+            if(file != NULL)
+            {
+                out.append('/');
+                out.append(file, file_length);
+            }
+
+            out.append('\n');
+            break;
+
+        case NUL:
+            if(directory == NULL)
+            {
+                out.append(disc_name, disc_length);
+            }
+            else
+            {
+                out.append(directory, directory_length);
+
+                if(file != NULL)
+                {
+                    out.append('/');
+                    out.append(file, file_length);
+                }
+            }
+
+            out.append('\0');
+            break;
+
+        case TSV:
+            if(group != NULL)
+            {
+                append_escaped(group, group_length);
+                out.append('\t');
+            }
+
+            append_escaped(disc_name, disc_length);
+
+            if(directory != NULL)
+            {
+                out.append('\t');
+                append_escaped(directory, directory_length);
+            }
+
+            if(file != NULL)
+            {
+                out.append('/');
+                append_escaped(file, file_length);
+            }
+
+            out.append('\n');
+            break;
+
+        case JSON_LINES:
+            out.append('{');
+
+            if(group != NULL)
+            {
+                out.append("\"group\":\"", 9);
+                append_escaped(group, group_length);
+                out.append("\",", 2);
+            }
+
+            out.append("\"disc\":\"", 8);
+            append_escaped(disc_name, disc_length);
+            out.append('"');
+
+            if(directory != NULL)
+            {
+                out.append(",\"path\":\"", 9);
+                append_escaped(directory, directory_length);
+
+                if(file != NULL)
+                {
+                    out.append('/');
+                    append_escaped(file, file_length);
+                }
+
+                out.append('"');
+            }
+
+            out.append("}\n", 2);
+            break;
+
+        case BINARY:
+            out.append(static_cast<char>((group != NULL ? 1 : 0) + 1 + (directory != NULL ? 1 : 0)));
+
+            if(group != NULL)
+            {
+                append_length(group_length);
+                out.append(group, group_length);
+            }
+
+            append_length(disc_length);
+            out.append(disc_name, disc_length);
+
+            if(directory != NULL)
+            {
+                append_length(path_length);
+                out.append(directory, directory_length);
+
+                if(file != NULL)
+                {
+                    out.append('/');
+                    out.append(file, file_length);
+                }
+            }
+            break;
+    }
+
+    return wants_more();
 }
 
 void
-Print::add_directory(const char* disc_name, const char* directory)
+Print::append_escaped(const char* text, size_t length)
 {
-    std::ostringstream line;
+    if(format == JSON_LINES)
+    {
+        append_json(out, text, length);
+        return;
+    }
+
+    // Copy runs of ordinary characters at once
+    size_t start = 0;
+
+    for(size_t i = 0; i < length; i++)
+    {
+        char c = text[i];
 
-    // Create an output line
-    line << disc_name << ':' << '\t' << directory << std::endl;
+        if(c != '\t' && c != '\n' && c != '\r' && c != '\\')
+            continue;
 
-    // Push line to results
-    results.push_back(line.str());
+        out.append(text + start, i - start);
+        start = i + 1;
+
+        out.append('\\');
+        out.append(c == '\t' ? 't' : c == '\n' ? 'n' : c == '\r' ? 'r' : '\\');
+    }
+
+    out.append(text + start, length - start);
 }
 
 void
-Print::add_file(const char* disc_name, const char* directory, const char* file)
+Print::append_length(size_t length)
 {
-    std::ostringstream line;
+    // Little endian, whatever the byte order of the machine
+    char bytes[4];
 
-    // Create an output line
-    line << disc_name << ':' << '\t' << directory << '/' << file << std::endl;
+    bytes[0] = static_cast<char>(length & 0xff);
+    bytes[1] = static_cast<char>((length >> 8) & 0xff);
+    bytes[2] = static_cast<char>((length >> 16) & 0xff);
+    bytes[3] = static_cast<char>((length >> 24) & 0xff);
 
-    // Push line to results
-    results.push_back(line.str());
+    out.append(bytes, sizeof(bytes));
 }
 
 void
 Print::output(void)
 {
-    // Sort results
-    std::sort(results.begin(), results.end());
+    if(format == TEXT)
+    {
+        // Results were printed already, keep the empty lines around them
+        if(printed == 0)
+            out.append('\n');
 
-    // First, print one empty line to separate the following output
-    std::cout << std::endl;
+        // Separate output from the following prompt
+        out.append('\n');
+    }
 
-    // Second print all results
-    foreach(std::string line, results)
-        std::cout << line << std::endl;
+    out.flush();
 
-    // Third, separate output from the following prompt
-    std::cout << std::endl;
+    if(stats != NULL)
+        stats->add_count("results", printed);
 }
@@ -15,8 +15,66 @@
 #ifndef PRINT_HPP
 #define PRINT_HPP
 
+#include <cstring>
+#include <iostream>
 #include <string>
-#include <vector>
+
+class Stats;
+
+/*
+ * Output through one large buffer, which is handed on as a whole when
+ * full: with write(2) to a file descriptor or to a stream.
+ */
+class Writer
+{
+public:
+    Writer(int fd);
+    Writer(std::ostream& stream);
+    ~Writer();
+    inline void append(const char* data, size_t length)
+    {
+        if(length > capacity - used)
+        {
+            flush();
+
+            // Larger than the whole buffer, pass it on directly
+            if(length > capacity)
+            {
+                write_out(data, length);
+                return;
+            }
+        }
+
+        memcpy(buffer + used, data, length);
+        used += length;
+    }
+    inline void append(char c)
+    {
+        if(used == capacity)
+            flush();
+
+        buffer[used++] = c;
+    }
+    void flush(void);
+    // Whether the output went away, like a closed pipe
+    bool failed(void);
+    // Time and bytes of the writes go to the statistics, if any
+    void set_stats(Stats* stats);
+private:
+    Writer(const Writer&);
+    Writer& operator=(const Writer&);
+    void write_out(const char* data, size_t length);
+    int fd;
+    std::ostream* stream;
+    char* buffer;
+    size_t capacity;
+    size_t used;
+    bool error;
+    Stats* stats;
+};
+
+// Appends text as the contents of a JSON string; bytes that are not valid UTF-8 become U+FFFD
+void append_json(Writer& out, const char* text, size_t length);
 
 class Print
 {
@@ -29,17 +87,62 @@ public:
         DEBUG = 3,
         VERBOSE_DEBUG = 4
     };
+    /*
+     * Layouts of the results:
+     * TEXT        "disc:<TAB>path" lines between empty lines
+     * NUL         paths only (disc names when listing discs), each ended by NUL
+     * TSV         disc and path separated by TAB, with \t, \n, \r and \\ escaped
+     * JSON_LINES  one object with "disc" and "path" per line, with bytes
+     *             of names that are not valid UTF-8 replaced by U+FFFD
+     * BINARY      records of a byte with the number of fields, each field
+     *             following its length as 32 bit little endian number
+     * Duplicates lead with their group as an additional field. Discs
+     * listed with their counts follow their name with the number of files
+     * and the number of directories, as "files" and "directories" in JSON.
+     */
+    enum Format
+    {
+        TEXT = 0,
+        NUL = 1,
+        TSV = 2,
+        JSON_LINES = 3,
+        BINARY = 4
+    };
+    // Print to the standard output
     Print(enum Verbosity verbosity = CRITICAL);
+    Print(enum Verbosity verbosity, std::ostream& out);
     virtual ~Print();
     enum Verbosity get_verbosity(void);
+    // Print at most the given number of results, 0 for all of them
+    void set_limit(unsigned long limit);
+    void set_format(enum Format format);
+    void set_stats(Stats* stats);
     void msg(const char* text, enum Verbosity message_verbosity);
-    void add_disc(const char* disc_name);
-    void add_directory(const char* disc_name, const char* directory);
-    void add_file(const char* disc_name, const char* directory, const char* file);
+    // Results are printed as they come; false once no more are wanted
+    bool add_disc(const char* disc_name, size_t disc_length);
+    bool add_disc(const char* disc_name, size_t disc_length, unsigned long files, unsigned long directories);
+    bool add_directory(const char* disc_name, size_t disc_length, const char* directory, size_t directory_length);
+    bool add_file(const char* disc_name, size_t disc_length, const char* directory, size_t directory_length,
+                  const char* file, size_t file_length);
+    bool add_duplicate(const char* group, size_t group_length, const char* disc_name, size_t disc_length,
+                       const char* directory, size_t directory_length, const char* file, size_t file_length);
+    // False once the limit is reached or the output failed
+    bool wants_more(void);
+    // Ends the results
     void output(void);
 private:
+    bool add_result(const char* group, size_t group_length, const char* disc_name, size_t disc_length,
+                    const char* directory, size_t directory_length, const char* file, size_t file_length);
+    void append_escaped(const char* text, size_t length);
+    void append_length(size_t length);
+    bool start_result(void);
     enum Verbosity specified_verbosity;
-    std::vector<std::string> results;
+    enum Format format;
+    // Where messages and results go
+    Writer out;
+    unsigned long limit;
+    unsigned long printed;
+    Stats* stats;
 };
 
 #endif /* PRINT_HPP */
@@ -0,0 +1,211 @@
+/**
+ *  scan.cpp
+ *
+ *  Substring scanning part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#include "scan.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+
+static inline unsigned char
+lower(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// Setting this bit turns upper case letters into lower case ones
+static inline unsigned char
+case_mask(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') ? 0x20 : 0x00;
+}
+
+
+Scanner::Scanner(const char* text, size_t length) :
+    kernel(find_scalar), kernel_name("scalar")
+{
+    for(size_t i = 0; i < length; i++)
+        this->text.push_back(lower(text[i]));
+
+    if(length > 0)
+    {
+        first = this->text[0];
+        first_mask = case_mask(first);
+        last = this->text[length - 1];
+        last_mask = case_mask(last);
+    }
+    else
+    {
+        first = first_mask = last = last_mask = 0;
+    }
+
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2"))
+    {
+        kernel = find_avx2;
+        kernel_name = "avx2";
+    }
+    else if(__builtin_cpu_supports("sse2"))
+    {
+        kernel = find_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+size_t
+Scanner::find(const char* buffer, size_t start, size_t end) const
+{
+    // An empty text is everywhere
+    if(text.empty())
+        return start < end ? start : end;
+
+    if(start >= end || end - start < text.length())
+        return end;
+
+    return kernel(*this, buffer, start, end);
+}
+
+const char*
+Scanner::get_kernel(void) const
+{
+    return kernel_name;
+}
+
+bool
+Scanner::matches(const char* candidate) const
+{
+    for(size_t i = 0; i < text.length(); i++)
+    {
+        if(lower(candidate[i]) != static_cast<unsigned char>(text[i]))
+            return false;
+    }
+
+    return true;
+}
+
+size_t
+Scanner::find_scalar(const Scanner& scanner, const char* buffer, size_t start, size_t end)
+{
+    size_t length = scanner.text.length();
+
+    for(size_t i = start; i + length <= end; i++)
+    {
+        if((static_cast<unsigned char>(buffer[i]) | scanner.first_mask) == scanner.first &&
+           scanner.matches(buffer + i))
+            return i;
+    }
+
+    return end;
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2")))
+size_t
+Scanner::find_sse2(const Scanner& scanner, const char* buffer, size_t start, size_t end)
+{
+    size_t length = scanner.text.length();
+
+    const __m128i first = _mm_set1_epi8(scanner.first);
+    const __m128i first_mask = _mm_set1_epi8(scanner.first_mask);
+    const __m128i last = _mm_set1_epi8(scanner.last);
+    const __m128i last_mask = _mm_set1_epi8(scanner.last_mask);
+
+    // Positions where the text would still fit
+    size_t limit = end - length + 1;
+    size_t i = start;
+
+    for(; i + 16 <= limit; i += 16)
+    {
+        __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + i));
+        __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + i + length - 1));
+
+        __m128i equal_first = _mm_cmpeq_epi8(_mm_or_si128(block_first, first_mask), first);
+        __m128i equal_last = _mm_cmpeq_epi8(_mm_or_si128(block_last, last_mask), last);
+
+        unsigned int candidates = _mm_movemask_epi8(_mm_and_si128(equal_first, equal_last));
+
+        while(candidates != 0)
+        {
+            size_t position = i + __builtin_ctz(candidates);
+
+            if(scanner.matches(buffer + position))
+                return position;
+
+            candidates &= candidates - 1;
+        }
+    }
+
+    return find_scalar(scanner, buffer, i, end);
+}
+
+__attribute__((target("avx2")))
+size_t
+Scanner::find_avx2(const Scanner& scanner, const char* buffer, size_t start, size_t end)
+{
+    size_t length = scanner.text.length();
+
+    const __m256i first = _mm256_set1_epi8(scanner.first);
+    const __m256i first_mask = _mm256_set1_epi8(scanner.first_mask);
+    const __m256i last = _mm256_set1_epi8(scanner.last);
+    const __m256i last_mask = _mm256_set1_epi8(scanner.last_mask);
+
+    // Positions where the text would still fit
+    size_t limit = end - length + 1;
+    size_t i = start;
+
+    for(; i + 32 <= limit; i += 32)
+    {
+        __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer + i));
+        __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer + i + length - 1));
+
+        __m256i equal_first = _mm256_cmpeq_epi8(_mm256_or_si256(block_first, first_mask), first);
+        __m256i equal_last = _mm256_cmpeq_epi8(_mm256_or_si256(block_last, last_mask), last);
+
+        unsigned int candidates = _mm256_movemask_epi8(_mm256_and_si256(equal_first, equal_last));
+
+        while(candidates != 0)
+        {
+            size_t position = i + __builtin_ctz(candidates);
+
+            if(scanner.matches(buffer + position))
+                return position;
+
+            candidates &= candidates - 1;
+        }
+    }
+
+    return find_sse2(scanner, buffer, i, end);
+}
+
+#else
+
+size_t
+Scanner::find_sse2(const Scanner& scanner, const char* buffer, size_t start, size_t end)
+{
+    return find_scalar(scanner, buffer, start, end);
+}
+
+size_t
+Scanner::find_avx2(const Scanner& scanner, const char* buffer, size_t start, size_t end)
+{
+    return find_scalar(scanner, buffer, start, end);
+}
+
+#endif /* SCAN_X86 */
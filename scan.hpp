@@ -0,0 +1,51 @@
+/**
+ *  scan.hpp
+ *
+ *  Substring scanning include part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <string>
+
+
+/*
+ * Finds a text in a large buffer of names, ignoring the case of ASCII
+ * letters like LIKE does. Blocks of the buffer are compared with the
+ * first and the last character of the text at once, using AVX2 or SSE2
+ * where the processor has them; only the positions where both agree
+ * are compared in full.
+ */
+class Scanner
+{
+public:
+    Scanner(const char* text, size_t length);
+    // Position of the next occurrence in [start, end), end if there is none
+    size_t find(const char* buffer, size_t start, size_t end) const;
+    // Name of the kernel in use, for diagnostics
+    const char* get_kernel(void) const;
+private:
+    typedef size_t (*Kernel)(const Scanner& scanner, const char* buffer, size_t start, size_t end);
+    static size_t find_scalar(const Scanner& scanner, const char* buffer, size_t start, size_t end);
+    static size_t find_sse2(const Scanner& scanner, const char* buffer, size_t start, size_t end);
+    static size_t find_avx2(const Scanner& scanner, const char* buffer, size_t start, size_t end);
+    bool matches(const char* candidate) const;
+    // Text in lower case
+    std::string text;
+    // Bits to set in a character before comparing it with the first and the last one
+    unsigned char first, first_mask;
+    unsigned char last, last_mask;
+    Kernel kernel;
+    const char* kernel_name;
+};
+
+#endif /* SCAN_HPP */
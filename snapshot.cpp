@@ -0,0 +1,762 @@
+/**
+ *  snapshot.cpp
+ *
+ *  Snapshot part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#include "snapshot.hpp"
+#include "match.hpp"
+#include "scan.hpp"
+
+#include <algorithm>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace snapshot;
+
+
+static const char MAGIC[8] = { 'D', 'D', 'B', 'S', 'N', 'A', 'P', '\0' };
+static const boost::uint32_t BYTE_ORDER_MARK = 0x01020304;
+static const boost::uint32_t SNAPSHOT_VERSION = 1;
+
+// Offsets and numbers are 32 bit
+static const boost::uint64_t SNAPSHOT_LIMIT = 0xffffffffULL;
+
+static inline char
+lower(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// Position after the UTF-8 character at the given one
+static inline size_t
+next_character(const char* text, size_t length, size_t i)
+{
+    i++;
+
+    while(i < length && (static_cast<unsigned char>(text[i]) & 0xc0) == 0x80)
+        i++;
+
+    return i;
+}
+
+bool
+like(const char* pattern, size_t pattern_length, const char* text, size_t text_length)
+{
+    size_t p = 0, t = 0;
+
+    // Where to go on after the last %, if the rest does not match
+    bool wildcard = false;
+    size_t wildcard_p = 0, wildcard_t = 0;
+
+    while(t < text_length)
+    {
+        if(p < pattern_length && pattern[p] == '%')
+        {
+            wildcard = true;
+            wildcard_p = ++p;
+            wildcard_t = t;
+        }
+        else if(p < pattern_length && pattern[p] == '_')
+        {
+            p++;
+            t = next_character(text, text_length, t);
+        }
+        else if(p < pattern_length && lower(pattern[p]) == lower(text[t]))
+        {
+            p++;
+            t++;
+        }
+        else if(wildcard)
+        {
+            // Let the last % take one more character
+            wildcard_t = next_character(text, text_length, wildcard_t);
+            t = wildcard_t;
+            p = wildcard_p;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while(p < pattern_length && pattern[p] == '%')
+        p++;
+
+    return p == pattern_length;
+}
+
+static void
+append_name(std::string& path, const char* name, size_t length)
+{
+    if(path.empty() || path[path.length()-1] != '/')
+        path.push_back('/');
+
+    path.append(name, length);
+}
+
+// Finds files by the position of their names
+class NameOffsetOrder
+{
+public:
+    bool operator()(size_t position, const File& file) const
+    {
+        return position < file.name;
+    }
+};
+
+// Finds file numbers in the name index by the text the names start with
+class NameIndexOrder
+{
+public:
+    NameIndexOrder(const File* files, const char* strings) :
+        files(files), strings(strings)
+    {
+    }
+    bool operator()(boost::uint32_t number, const std::string& text) const
+    {
+        const File& file = files[number];
+
+        int order = memcmp(strings + file.name, text.data(), std::min<size_t>(file.name_length, text.length()));
+
+        return order < 0 || (order == 0 && file.name_length < text.length());
+    }
+private:
+    const File* files;
+    const char* strings;
+};
+
+// Orders file numbers by the names of the files
+class NameOrder
+{
+public:
+    NameOrder(const std::vector<File>& files, const std::string& strings) :
+        files(&files), strings(strings.data())
+    {
+    }
+    bool operator()(boost::uint32_t a, boost::uint32_t b) const
+    {
+        const File& file_a = (*files)[a];
+        const File& file_b = (*files)[b];
+
+        int order = memcmp(strings + file_a.name, strings + file_b.name,
+                           std::min(file_a.name_length, file_b.name_length));
+
+        if(order != 0)
+            return order < 0;
+
+        if(file_a.name_length != file_b.name_length)
+            return file_a.name_length < file_b.name_length;
+
+        return a < b;
+    }
+private:
+    const std::vector<File>* files;
+    const char* strings;
+};
+
+
+SnapshotWriter::SnapshotWriter(void)
+{
+}
+
+boost::uint32_t
+SnapshotWriter::add_string(const char* text, size_t length) throw(DBError)
+{
+    if(strings.length() + length + 1 > SNAPSHOT_LIMIT)
+        throw(DBError("Catalog too large for a snapshot", DBError::FILE_ERROR));
+
+    boost::uint32_t offset = strings.length();
+
+    strings.append(text, length);
+    strings.push_back('\0');
+
+    return offset;
+}
+
+void
+SnapshotWriter::add_disc(const char* name, size_t length) throw(DBError)
+{
+    Disc disc;
+
+    disc.name = add_string(name, length);
+    disc.name_length = length;
+    disc.first_directory = disc.directories_end = directories.size();
+
+    discs.push_back(disc);
+}
+
+boost::uint32_t
+SnapshotWriter::add_directory(boost::uint32_t parent, const char* name, size_t length) throw(DBError)
+{
+    if(discs.empty() || directories.size() >= NO_PARENT)
+        throw(DBError("Could not add directory to snapshot", DBError::FILE_ERROR));
+
+    // Readers build paths in one pass
+    if(parent != NO_PARENT && parent >= directories.size())
+        throw(DBError("Directory added to snapshot before its parent", DBError::FILE_ERROR));
+
+    Directory directory;
+
+    directory.parent = parent;
+    directory.name = add_string(name, length);
+    directory.name_length = length;
+    directory.first_file = directory.files_end = files.size();
+    directory.disc = discs.size() - 1;
+
+    directories.push_back(directory);
+    discs.back().directories_end = directories.size();
+
+    return directories.size() - 1;
+}
+
+void
+SnapshotWriter::add_file(const char* name, size_t length) throw(DBError)
+{
+    if(directories.empty() || files.size() >= NO_PARENT)
+        throw(DBError("Could not add file to snapshot", DBError::FILE_ERROR));
+
+    File file;
+
+    file.directory = directories.size() - 1;
+    file.name = add_string(name, length);
+    file.name_length = length;
+
+    files.push_back(file);
+    directories.back().files_end = files.size();
+}
+
+void
+SnapshotWriter::write(const char* filename) throw(DBError)
+{
+    std::string error_message = std::string("Could not write snapshot ") + filename;
+
+    // Index of the names
+    std::vector<boost::uint32_t> names(files.size());
+
+    for(size_t i = 0; i < names.size(); i++)
+        names[i] = i;
+
+    std::sort(names.begin(), names.end(), NameOrder(files, strings));
+
+    Header header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+
+    header.byte_order = BYTE_ORDER_MARK;
+    header.version = SNAPSHOT_VERSION;
+    header.disc_count = discs.size();
+    header.directory_count = directories.size();
+    header.file_count = files.size();
+    header.strings_size = strings.length();
+
+    // Sections follow each other, all of them aligned to their numbers
+    boost::uint64_t offset = sizeof(Header);
+
+    header.discs_offset = offset;
+    offset += discs.size() * sizeof(Disc);
+    header.directories_offset = offset;
+    offset += directories.size() * sizeof(Directory);
+    header.files_offset = offset;
+    offset += files.size() * sizeof(File);
+    header.names_offset = offset;
+    offset += names.size() * sizeof(boost::uint32_t);
+    header.strings_offset = offset;
+    offset += strings.length();
+
+    if(offset > SNAPSHOT_LIMIT)
+        throw(DBError("Catalog too large for a snapshot", DBError::FILE_ERROR));
+
+    header.total_size = offset;
+
+    // Replace an older snapshot only when the new one is complete
+    std::string temporary = std::string(filename) + ".tmp";
+
+    FILE* file = fopen(temporary.c_str(), "wb");
+
+    if(file == NULL)
+        throw(DBError(error_message, DBError::FILE_ERROR));
+
+    fwrite(&header, sizeof(header), 1, file);
+
+    if(!discs.empty())
+        fwrite(&discs[0], sizeof(Disc), discs.size(), file);
+
+    if(!directories.empty())
+        fwrite(&directories[0], sizeof(Directory), directories.size(), file);
+
+    if(!files.empty())
+        fwrite(&files[0], sizeof(File), files.size(), file);
+
+    if(!names.empty())
+        fwrite(&names[0], sizeof(boost::uint32_t), names.size(), file);
+
+    fwrite(strings.data(), 1, strings.length(), file);
+
+    bool success = !ferror(file);
+
+    if(fclose(file) != 0)
+        success = false;
+
+#ifdef _WIN32
+    if(success)
+        remove(filename);
+#endif
+
+    if(!success || rename(temporary.c_str(), filename) != 0)
+    {
+        remove(temporary.c_str());
+        throw(DBError(error_message, DBError::FILE_ERROR));
+    }
+}
+
+
+Snapshot::Snapshot(Print* print) :
+    p(print), data(NULL), size(0), mapped(false),
+    header(NULL), discs(NULL), directories(NULL), files(NULL), names(NULL), strings(NULL)
+{
+}
+
+Snapshot::~Snapshot(void)
+{
+    close();
+}
+
+void
+Snapshot::open(const char* filename) throw(DBError)
+{
+    std::string error_message = std::string("Could not open snapshot ") + filename;
+
+    p->msg("Opening snapshot...", Print::VERBOSE);
+
+#ifdef _WIN32
+    // Without mapping, read it as a whole
+    FILE* file = fopen(filename, "rb");
+
+    if(file == NULL)
+        throw(DBError(error_message, DBError::FILE_ERROR));
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* buffer = static_cast<char*>(malloc(length > 0 ? length : 1));
+
+    if(length < 0 || buffer == NULL || fread(buffer, 1, length, file) != static_cast<size_t>(length))
+    {
+        free(buffer);
+        fclose(file);
+        throw(DBError(error_message, DBError::FILE_ERROR));
+    }
+
+    fclose(file);
+
+    data = buffer;
+    size = length;
+#else
+    int fd = ::open(filename, O_RDONLY);
+
+    if(fd < 0)
+        throw(DBError(error_message, DBError::FILE_ERROR));
+
+    struct stat status;
+
+    if(fstat(fd, &status) != 0 || status.st_size == 0)
+    {
+        ::close(fd);
+        throw(DBError(error_message, DBError::FILE_ERROR));
+    }
+
+    // Shared pages, every reader uses the same page cache
+    void* memory = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+    ::close(fd);
+
+    if(memory == MAP_FAILED)
+        throw(DBError(error_message, DBError::FILE_ERROR));
+
+    data = static_cast<const char*>(memory);
+    size = status.st_size;
+    mapped = true;
+#endif
+
+    // Snapshots are copied around, so nothing in them is trusted before it is checked
+    header = reinterpret_cast<const Header*>(data);
+
+    bool valid = size >= sizeof(Header) &&
+                 memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                 header->byte_order == BYTE_ORDER_MARK &&
+                 header->version == SNAPSHOT_VERSION &&
+                 header->total_size == size;
+
+    valid = valid &&
+            header->discs_offset == sizeof(Header) &&
+            header->directories_offset == header->discs_offset + (boost::uint64_t) header->disc_count * sizeof(Disc) &&
+            header->files_offset == header->directories_offset + (boost::uint64_t) header->directory_count * sizeof(Directory) &&
+            header->names_offset == header->files_offset + (boost::uint64_t) header->file_count * sizeof(File) &&
+            header->strings_offset == header->names_offset + (boost::uint64_t) header->file_count * sizeof(boost::uint32_t) &&
+            header->total_size == header->strings_offset + (boost::uint64_t) header->strings_size;
+
+    if(valid)
+    {
+        discs = reinterpret_cast<const Disc*>(data + header->discs_offset);
+        directories = reinterpret_cast<const Directory*>(data + header->directories_offset);
+        files = reinterpret_cast<const File*>(data + header->files_offset);
+        names = reinterpret_cast<const boost::uint32_t*>(data + header->names_offset);
+        strings = data + header->strings_offset;
+
+        valid = sections_valid();
+    }
+
+    if(!valid)
+    {
+        close();
+        throw(DBError(std::string("Wrong snapshot ") + filename, DBError::FILE_ERROR));
+    }
+
+    p->msg("Done.", Print::DEBUG);
+}
+
+/*
+ * Check once what searches and listings rely on: the directories of the
+ * discs and the files of the directories follow each other without gaps,
+ * parents come before their children on the same disc, and all numbers
+ * and names lie within their sections.
+ */
+bool
+Snapshot::sections_valid(void) const
+{
+    boost::uint32_t directories_end = 0;
+
+    for(boost::uint32_t i = 0; i < header->disc_count; i++)
+    {
+        const Disc& disc = discs[i];
+
+        if(!string_valid(disc.name, disc.name_length) ||
+           disc.first_directory != directories_end || disc.directories_end < disc.first_directory)
+            return false;
+
+        directories_end = disc.directories_end;
+    }
+
+    if(directories_end != header->directory_count)
+        return false;
+
+    boost::uint32_t files_end = 0;
+
+    for(boost::uint32_t d = 0; d < header->directory_count; d++)
+    {
+        const Directory& directory = directories[d];
+
+        if(directory.disc >= header->disc_count)
+            return false;
+
+        const Disc& disc = discs[directory.disc];
+
+        if(d < disc.first_directory || d >= disc.directories_end)
+            return false;
+
+        if(directory.parent != NO_PARENT && (directory.parent < disc.first_directory || directory.parent >= d))
+            return false;
+
+        if(!string_valid(directory.name, directory.name_length) ||
+           directory.first_file != files_end || directory.files_end < directory.first_file)
+            return false;
+
+        files_end = directory.files_end;
+    }
+
+    if(files_end != header->file_count)
+        return false;
+
+    for(boost::uint32_t f = 0; f < header->file_count; f++)
+    {
+        const File& file = files[f];
+
+        if(file.directory >= header->directory_count ||
+           f < directories[file.directory].first_file || f >= directories[file.directory].files_end)
+            return false;
+
+        // Scans find files by the position of their names
+        if(!string_valid(file.name, file.name_length) || (f > 0 && file.name <= files[f-1].name))
+            return false;
+
+        if(names[f] >= header->file_count)
+            return false;
+    }
+
+    return true;
+}
+
+bool
+Snapshot::string_valid(boost::uint32_t offset, boost::uint32_t length) const
+{
+    return offset <= header->strings_size && length <= header->strings_size - offset;
+}
+
+void
+Snapshot::close(void)
+{
+    if(data == NULL)
+        return;
+
+#ifdef _WIN32
+    free(const_cast<char*>(data));
+#else
+    if(mapped)
+        munmap(const_cast<char*>(data), size);
+#endif
+
+    data = NULL;
+    header = NULL;
+    size = 0;
+    mapped = false;
+}
+
+void
+Snapshot::list_discs(void)
+{
+    for(boost::uint32_t i = 0; i < header->disc_count; i++)
+    {
+        const Disc& disc = discs[i];
+
+        // Directories and their files are stored disc by disc
+        unsigned long files = disc.first_directory == disc.directories_end ? 0 :
+            directories[disc.directories_end-1].files_end - directories[disc.first_directory].first_file;
+
+        if(!p->add_disc(string_at(disc.name), disc.name_length, files, disc.directories_end - disc.first_directory))
+            break;
+    }
+}
+
+void
+Snapshot::list_files(const char* disc_name, bool directories_only)
+{
+    size_t disc_name_length = strlen(disc_name);
+
+    bool more = true;
+
+    for(boost::uint32_t i = 0; more && i < header->disc_count; i++)
+    {
+        const Disc& disc = discs[i];
+        const char* name = string_at(disc.name);
+
+        if(!like(disc_name, disc_name_length, name, disc.name_length))
+            continue;
+
+        // Parents come before their children
+        std::vector<std::string> paths(disc.directories_end - disc.first_directory);
+
+        for(boost::uint32_t d = disc.first_directory; more && d < disc.directories_end; d++)
+        {
+            const Directory& directory = directories[d];
+            std::string& path = paths[d - disc.first_directory];
+
+            if(directory.parent == NO_PARENT)
+            {
+                path.assign(string_at(directory.name), directory.name_length);
+            }
+            else
+            {
+                path = paths[directory.parent - disc.first_directory];
+                append_name(path, string_at(directory.name), directory.name_length);
+            }
+
+            if(directories_only)
+            {
+                more = p->add_directory(name, disc.name_length, path.data(), path.length());
+                continue;
+            }
+
+            for(boost::uint32_t f = directory.first_file; more && f < directory.files_end; f++)
+            {
+                more = p->add_file(name, disc.name_length, path.data(), path.length(),
+                                   string_at(files[f].name), files[f].name_length);
+            }
+        }
+    }
+}
+
+void
+Snapshot::search_text(const char* text, bool directories_only, const Matcher* matcher)
+{
+    std::string pattern = std::string("%") + text + "%";
+
+    bool more = true;
+
+    if(directories_only)
+    {
+        for(boost::uint32_t i = 0; more && i < header->disc_count; i++)
+        {
+            const Disc& disc = discs[i];
+            std::vector<std::string> paths(disc.directories_end - disc.first_directory);
+
+            for(boost::uint32_t d = disc.first_directory; more && d < disc.directories_end; d++)
+            {
+                const Directory& directory = directories[d];
+                std::string& path = paths[d - disc.first_directory];
+
+                if(directory.parent == NO_PARENT)
+                {
+                    path.assign(string_at(directory.name), directory.name_length);
+                }
+                else
+                {
+                    path = paths[directory.parent - disc.first_directory];
+                    append_name(path, string_at(directory.name), directory.name_length);
+                }
+
+                if(matcher != NULL ? matcher->matches(path.data(), path.length()) :
+                   like(pattern.data(), pattern.length(), path.data(), path.length()))
+                    more = p->add_directory(string_at(disc.name), disc.name_length, path.data(), path.length());
+            }
+        }
+
+        return;
+    }
+
+    // Without wildcards, scan all names at once
+    if(matcher == NULL && strpbrk(text, "%_") == NULL && text[0] != '\0')
+    {
+        scan_text(text);
+        return;
+    }
+
+    // Names starting with the prefix of the pattern are neighbours in the index
+    boost::uint32_t i = 0;
+    boost::uint32_t names_end = header->file_count;
+
+    if(matcher != NULL && !matcher->get_prefix().empty())
+    {
+        NameIndexOrder order(files, strings);
+
+        i = std::lower_bound(names, names + names_end, matcher->get_prefix(), order) - names;
+
+        if(!matcher->get_prefix_end().empty())
+            names_end = std::lower_bound(names + i, names + names_end, matcher->get_prefix_end(), order) - names;
+    }
+
+    // Equal names are neighbours in the index, match each of them once
+    std::vector<boost::uint32_t> found;
+
+    while(i < names_end)
+    {
+        const File& file = files[names[i]];
+        const char* name = string_at(file.name);
+
+        boost::uint32_t end = i + 1;
+
+        while(end < names_end &&
+              files[names[end]].name_length == file.name_length &&
+              memcmp(string_at(files[names[end]].name), name, file.name_length) == 0)
+            end++;
+
+        if(matcher != NULL ? matcher->matches(name, file.name_length) :
+           like(pattern.data(), pattern.length(), name, file.name_length))
+            found.insert(found.end(), names + i, names + end);
+
+        i = end;
+    }
+
+    // Files are stored in printing order
+    std::sort(found.begin(), found.end());
+
+    std::map<boost::uint32_t, std::string> paths;
+
+    for(size_t f = 0; more && f < found.size(); f++)
+    {
+        const File& file = files[found[f]];
+        const Disc& disc = discs[directories[file.directory].disc];
+        const std::string& path = directory_path(file.directory, paths);
+
+        more = p->add_file(string_at(disc.name), disc.name_length, path.data(), path.length(),
+                           string_at(file.name), file.name_length);
+    }
+}
+
+void
+Snapshot::scan_text(const char* text)
+{
+    Scanner scanner(text, strlen(text));
+
+    p->msg((std::string("Scanning names with ") + scanner.get_kernel() + " kernel").c_str(), Print::DEBUG);
+
+    std::map<boost::uint32_t, std::string> paths;
+
+    const File* files_end = files + header->file_count;
+    const File* file = files;
+
+    size_t position = 0;
+
+    bool more = true;
+
+    while(more && (position = scanner.find(strings, position, header->strings_size)) < header->strings_size)
+    {
+        // Names of files are stored in the order of the files, among the other names
+        const File* next = std::upper_bound(file, files_end, position, NameOffsetOrder());
+
+        if(next == files || position >= (next - 1)->name + (next - 1)->name_length)
+        {
+            // Name of a disc or a directory
+            position++;
+            file = next;
+            continue;
+        }
+
+        file = next - 1;
+
+        const Disc& disc = discs[directories[file->directory].disc];
+        const std::string& path = directory_path(file->directory, paths);
+
+        more = p->add_file(string_at(disc.name), disc.name_length, path.data(), path.length(),
+                           string_at(file->name), file->name_length);
+
+        // One hit per file is enough
+        position = file->name + file->name_length + 1;
+        file++;
+    }
+}
+
+const std::string&
+Snapshot::directory_path(boost::uint32_t directory, std::map<boost::uint32_t, std::string>& paths)
+{
+    // Path already known
+    std::map<boost::uint32_t, std::string>::iterator it = paths.find(directory);
+
+    if(it != paths.end())
+        return it->second;
+
+    const Directory& entry = directories[directory];
+
+    std::string path;
+
+    if(entry.parent == NO_PARENT)
+    {
+        path.assign(string_at(entry.name), entry.name_length);
+    }
+    else
+    {
+        path = directory_path(entry.parent, paths);
+        append_name(path, string_at(entry.name), entry.name_length);
+    }
+
+    return paths[directory] = path;
+}
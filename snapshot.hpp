@@ -0,0 +1,147 @@
+/**
+ *  snapshot.hpp
+ *
+ *  Snapshot include part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "error.hpp"
+#include "print.hpp"
+
+/*
+ * A snapshot is an immutable copy of the catalog, searched in place
+ * after mapping it into memory. All numbers are 32 bit in the byte order
+ * of the writing machine, which the header records.
+ *
+ * Header      magic, byte order, version, counts and section offsets
+ * Discs       name, first directory and end of its directories
+ * Directories parent (NO_PARENT for roots), name, files and disc
+ * Files       directory and name
+ * Name index  file numbers ordered by name
+ * Strings     all names, each followed by NUL
+ *
+ * Discs come ordered by name, the directories of a disc by path and the
+ * files of a directory by name, which is the order results are printed.
+ */
+namespace snapshot
+{
+    const boost::uint32_t NO_PARENT = 0xffffffff;
+
+    struct Header
+    {
+        char magic[8];
+        boost::uint32_t byte_order;
+        boost::uint32_t version;
+        boost::uint32_t disc_count;
+        boost::uint32_t directory_count;
+        boost::uint32_t file_count;
+        boost::uint32_t strings_size;
+        boost::uint32_t discs_offset;
+        boost::uint32_t directories_offset;
+        boost::uint32_t files_offset;
+        boost::uint32_t names_offset;
+        boost::uint32_t strings_offset;
+        boost::uint32_t total_size;
+    };
+
+    struct Disc
+    {
+        boost::uint32_t name;
+        boost::uint32_t name_length;
+        boost::uint32_t first_directory;
+        boost::uint32_t directories_end;
+    };
+
+    struct Directory
+    {
+        boost::uint32_t parent;
+        boost::uint32_t name;
+        boost::uint32_t name_length;
+        boost::uint32_t first_file;
+        boost::uint32_t files_end;
+        boost::uint32_t disc;
+    };
+
+    struct File
+    {
+        boost::uint32_t directory;
+        boost::uint32_t name;
+        boost::uint32_t name_length;
+    };
+}
+
+class Matcher;
+
+// Collects the catalog in printing order and writes it as snapshot
+class SnapshotWriter
+{
+public:
+    SnapshotWriter(void);
+    void add_disc(const char* name, size_t length) throw(DBError);
+    // Directories of the last disc, parents first; returns the number of the directory
+    boost::uint32_t add_directory(boost::uint32_t parent, const char* name, size_t length) throw(DBError);
+    // Files of the last directory
+    void add_file(const char* name, size_t length) throw(DBError);
+    void write(const char* filename) throw(DBError);
+private:
+    boost::uint32_t add_string(const char* text, size_t length) throw(DBError);
+    std::vector<snapshot::Disc> discs;
+    std::vector<snapshot::Directory> directories;
+    std::vector<snapshot::File> files;
+    std::string strings;
+};
+
+// Answers searches and listings from a snapshot mapped into memory
+class Snapshot
+{
+public:
+    Snapshot(Print* print);
+    ~Snapshot(void);
+    void open(const char* filename) throw(DBError);
+    void close(void);
+    void list_discs(void);
+    void list_files(const char* disc_name, bool directories_only = false);
+    // Names containing the text, or matching the matcher if one is given
+    void search_text(const char* text, bool directories_only = false, const Matcher* matcher = NULL);
+private:
+    // Whether the sections are consistent, so that reading them stays within the file
+    bool sections_valid(void) const;
+    bool string_valid(boost::uint32_t offset, boost::uint32_t length) const;
+    void scan_text(const char* text);
+    const std::string& directory_path(boost::uint32_t directory, std::map<boost::uint32_t, std::string>& paths);
+    inline const char* string_at(boost::uint32_t offset) { return strings + offset; }
+    // Printer
+    Print* p;
+    // The mapped file
+    const char* data;
+    size_t size;
+    bool mapped;
+    const snapshot::Header* header;
+    const snapshot::Disc* discs;
+    const snapshot::Directory* directories;
+    const snapshot::File* files;
+    const boost::uint32_t* names;
+    const char* strings;
+};
+
+// Whether a text matches a pattern of LIKE, with % and _ as wildcards
+bool like(const char* pattern, size_t pattern_length, const char* text, size_t text_length);
+
+#endif /* SNAPSHOT_HPP */
@@ -0,0 +1,268 @@
+/**
+ *  socket.cpp
+ *
+ *  Local socket part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#include "socket.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// Seconds to wait for a slow client before giving up on it
+static const int CLIENT_TIMEOUT = 5;
+
+
+LocalSocket::LocalSocket(void) :
+    fd(-1)
+{
+}
+
+LocalSocket::~LocalSocket(void)
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool
+LocalSocket::listen(const std::string& /*path*/, std::string& error)
+{
+    error = "Local sockets are not supported on this platform";
+    return false;
+}
+
+bool
+LocalSocket::accept(LocalSocket& /*connection*/)
+{
+    return false;
+}
+
+bool
+LocalSocket::connect(const std::string& /*path*/, std::string& error)
+{
+    error = "Local sockets are not supported on this platform";
+    return false;
+}
+
+bool
+LocalSocket::send(const std::string& /*data*/)
+{
+    return false;
+}
+
+void
+LocalSocket::finish(void)
+{
+}
+
+bool
+LocalSocket::receive(std::string& /*data*/)
+{
+    return false;
+}
+
+void
+LocalSocket::close(void)
+{
+}
+
+#else
+
+// Fill in the address of a socket file
+static bool
+make_address(const std::string& path, struct sockaddr_un& address, std::string& error)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if(path.length() >= sizeof(address.sun_path))
+    {
+        error = "Socket path " + path + " is too long";
+        return false;
+    }
+
+    strcpy(address.sun_path, path.c_str());
+
+    return true;
+}
+
+bool
+LocalSocket::listen(const std::string& path, std::string& error)
+{
+    struct sockaddr_un address;
+
+    if(!make_address(path, address, error))
+        return false;
+
+    // Anything but a socket, like a mistyped catalog name, is left alone
+    struct stat status;
+
+    bool exists = (lstat(path.c_str(), &status) == 0);
+
+    if(exists && !S_ISSOCK(status.st_mode))
+    {
+        error = "Could not listen on " + path + ": file exists and is not a socket";
+        return false;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(fd < 0)
+    {
+        error = std::string("Could not create socket: ") + strerror(errno);
+        return false;
+    }
+
+    // A socket file left by a server that is gone can be replaced
+    LocalSocket probe;
+    std::string probe_error;
+
+    if(exists && !probe.connect(path, probe_error))
+        unlink(path.c_str());
+
+    if(bind(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+       ::listen(fd, SOMAXCONN) != 0)
+    {
+        error = "Could not listen on " + path + ": " + strerror(errno);
+        close();
+        return false;
+    }
+
+    this->path = path;
+
+    return true;
+}
+
+bool
+LocalSocket::accept(LocalSocket& connection)
+{
+    connection.close();
+    connection.fd = ::accept(fd, NULL, NULL);
+
+    if(connection.fd < 0)
+        return false;
+
+    // Do not let a stuck client block everybody else
+    struct timeval timeout;
+    timeout.tv_sec = CLIENT_TIMEOUT;
+    timeout.tv_usec = 0;
+
+    setsockopt(connection.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(connection.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    return true;
+}
+
+bool
+LocalSocket::connect(const std::string& path, std::string& error)
+{
+    struct sockaddr_un address;
+
+    if(!make_address(path, address, error))
+        return false;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if(fd < 0)
+    {
+        error = std::string("Could not create socket: ") + strerror(errno);
+        return false;
+    }
+
+    if(::connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        error = "Could not connect to " + path + ": " + strerror(errno);
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool
+LocalSocket::send(const std::string& data)
+{
+    const char* p = data.data();
+    size_t left = data.length();
+
+    while(left > 0)
+    {
+        ssize_t sent = ::send(fd, p, left, MSG_NOSIGNAL);
+
+        if(sent < 0 && errno == EINTR)
+            continue;
+
+        if(sent <= 0)
+            return false;
+
+        p += sent;
+        left -= sent;
+    }
+
+    return true;
+}
+
+void
+LocalSocket::finish(void)
+{
+    shutdown(fd, SHUT_WR);
+}
+
+bool
+LocalSocket::receive(std::string& data)
+{
+    char buffer[65536];
+
+    data.clear();
+
+    while(true)
+    {
+        ssize_t received = read(fd, buffer, sizeof(buffer));
+
+        if(received < 0 && errno == EINTR)
+            continue;
+
+        if(received < 0)
+            return false;
+
+        if(received == 0)
+            return true;
+
+        data.append(buffer, received);
+    }
+}
+
+void
+LocalSocket::close(void)
+{
+    if(fd < 0)
+        return;
+
+    ::close(fd);
+    fd = -1;
+
+    if(!path.empty())
+    {
+        unlink(path.c_str());
+        path.clear();
+    }
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,52 @@
+/**
+ *  socket.hpp
+ *
+ *  Local socket include part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#ifndef SOCKET_HPP
+#define SOCKET_HPP
+
+#include <string>
+
+
+/*
+ * Stream socket in the local file system, carrying the requests to and
+ * the answers of a ddb server. Each connection carries one request and
+ * its answer; each side marks the end of its data by closing its
+ * direction of the connection.
+ */
+class LocalSocket
+{
+public:
+    LocalSocket(void);
+    ~LocalSocket(void);
+    // Server side: create the socket file and wait for connections
+    bool listen(const std::string& path, std::string& error);
+    // Returns false if interrupted by a signal or on errors
+    bool accept(LocalSocket& connection);
+    // Client side
+    bool connect(const std::string& path, std::string& error);
+    bool send(const std::string& data);
+    // Ends sending, the other side reads the end of the data
+    void finish(void);
+    // Reads everything until the other side finished sending
+    bool receive(std::string& data);
+    void close(void);
+private:
+    LocalSocket(const LocalSocket&);
+    LocalSocket& operator=(const LocalSocket&);
+    int fd;
+    // Socket file to remove when closing a listening socket
+    std::string path;
+};
+
+#endif /* SOCKET_HPP */
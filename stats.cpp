@@ -0,0 +1,154 @@
+/**
+ *  stats.cpp
+ *
+ *  Statistics part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#include "stats.hpp"
+#include "print.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+
+Stats::Timer::Timer(Stats* stats, const char* phase) :
+    stats(stats), phase(phase), started(stats != NULL ? Stats::now() : 0)
+{
+}
+
+Stats::Timer::~Timer()
+{
+    if(stats != NULL)
+        stats->add_time(phase, Stats::now() - started);
+}
+
+
+Stats::Stats(void)
+{
+}
+
+void
+Stats::add_time(const char* phase, double seconds)
+{
+    // Only a few phases, looking them up is cheaper than a map
+    for(size_t i = 0; i < phases.size(); i++)
+    {
+        if(phases[i].name == phase)
+        {
+            phases[i].seconds += seconds;
+            phases[i].calls++;
+            return;
+        }
+    }
+
+    Phase added;
+    added.name = phase;
+    added.seconds = seconds;
+    added.calls = 1;
+
+    phases.push_back(added);
+}
+
+void
+Stats::add_count(const char* counter, unsigned long long count)
+{
+    for(size_t i = 0; i < counters.size(); i++)
+    {
+        if(counters[i].first == counter)
+        {
+            counters[i].second += count;
+            return;
+        }
+    }
+
+    counters.push_back(std::make_pair(std::string(counter), count));
+}
+
+void
+Stats::print(std::ostream& out, bool json) const
+{
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+
+    out << std::fixed << std::setprecision(6);
+
+    if(json)
+    {
+        // Names are escaped the same way as the results
+        Writer writer(out);
+
+        writer.append("{\"phases\":{", 11);
+
+        for(size_t i = 0; i < phases.size(); i++)
+        {
+            std::ostringstream values;
+            values << std::fixed << std::setprecision(6)
+                   << "\":{\"seconds\":" << phases[i].seconds << ",\"calls\":" << phases[i].calls << "}";
+
+            writer.append(i > 0 ? ",\"" : "\"", i > 0 ? 2 : 1);
+            append_json(writer, phases[i].name.data(), phases[i].name.size());
+            writer.append(values.str().data(), values.str().size());
+        }
+
+        writer.append("},\"counters\":{", 14);
+
+        for(size_t i = 0; i < counters.size(); i++)
+        {
+            std::ostringstream value;
+            value << "\":" << counters[i].second;
+
+            writer.append(i > 0 ? ",\"" : "\"", i > 0 ? 2 : 1);
+            append_json(writer, counters[i].first.data(), counters[i].first.size());
+            writer.append(value.str().data(), value.str().size());
+        }
+
+        writer.append("}}\n", 3);
+    }
+    else
+    {
+        for(size_t i = 0; i < phases.size(); i++)
+        {
+            out << phases[i].name << ":\t" << phases[i].seconds << " s in " << phases[i].calls
+                << (phases[i].calls == 1 ? " call" : " calls") << std::endl;
+        }
+
+        for(size_t i = 0; i < counters.size(); i++)
+            out << counters[i].first << ":\t" << counters[i].second << std::endl;
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+double
+Stats::now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    return (double) counter.QuadPart / frequency.QuadPart;
+#else
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec + time.tv_nsec / 1e9;
+#endif
+}
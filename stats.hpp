@@ -0,0 +1,63 @@
+/**
+ *  stats.hpp
+ *
+ *  Statistics include part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+/*
+ * Time spent in the phases of a run, measured with a monotonic clock, and
+ * counts of what they handled. Phases may repeat and nest; the time of a
+ * phase includes that of the phases within it. Both are reported in the
+ * order they first appeared.
+ */
+class Stats
+{
+public:
+    // Adds the time until its end to a phase; does nothing without statistics
+    class Timer
+    {
+    public:
+        Timer(Stats* stats, const char* phase);
+        ~Timer();
+    private:
+        Timer(const Timer&);
+        Timer& operator=(const Timer&);
+        Stats* stats;
+        const char* phase;
+        double started;
+    };
+    Stats(void);
+    void add_time(const char* phase, double seconds);
+    void add_count(const char* counter, unsigned long long count);
+    // Summary as "name:<TAB>value" lines, or as one JSON object
+    void print(std::ostream& out, bool json) const;
+    // Seconds since some fixed point in the past
+    static double now(void);
+private:
+    struct Phase
+    {
+        std::string name;
+        double seconds;
+        unsigned long calls;
+    };
+    std::vector<Phase> phases;
+    std::vector<std::pair<std::string, unsigned long long> > counters;
+};
+
+#endif /* STATS_HPP */
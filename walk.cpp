@@ -0,0 +1,550 @@
+/**
+ *  walk.cpp
+ *
+ *  Directory walking part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#include "walk.hpp"
+
+#include <cerrno>
+#include <ctime>
+#include <cstring>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#include <boost/foreach.hpp>
+
+// Use shortcut from example
+#define foreach BOOST_FOREACH
+
+// Use a shortcut
+namespace fs = boost::filesystem;
+
+
+EntryQueue::EntryQueue(size_t capacity) :
+    capacity(capacity), finished(false), cancelled(false)
+{
+}
+
+bool
+EntryQueue::push(Entry& entry)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    // Wait until the inserter made some room
+    while(entries.size() >= capacity && !cancelled)
+        not_full.wait(lock);
+
+    if(cancelled)
+        return false;
+
+    entries.push_back(entry);
+    not_empty.notify_one();
+
+    return true;
+}
+
+bool
+EntryQueue::push_all(std::vector<Entry>& group)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    // Wait for room, but let groups larger than the queue into an empty one
+    while(!entries.empty() && entries.size() + group.size() > capacity && !cancelled)
+        not_full.wait(lock);
+
+    if(cancelled)
+        return false;
+
+    entries.insert(entries.end(), group.begin(), group.end());
+    not_empty.notify_one();
+
+    return true;
+}
+
+size_t
+EntryQueue::pop(std::vector<Entry>& batch, size_t max_entries)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    batch.clear();
+
+    // Wait until the walker delivered something or is done
+    while(entries.empty() && !finished && !cancelled)
+        not_empty.wait(lock);
+
+    while(!entries.empty() && batch.size() < max_entries)
+    {
+        batch.push_back(entries.front());
+        entries.pop_front();
+    }
+
+    not_full.notify_one();
+
+    return batch.size();
+}
+
+void
+EntryQueue::finish(void)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    finished = true;
+    not_empty.notify_all();
+}
+
+void
+EntryQueue::fail(const std::string& message)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    error = message;
+    finished = true;
+    not_empty.notify_all();
+}
+
+void
+EntryQueue::cancel(void)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    cancelled = true;
+    entries.clear();
+    not_full.notify_all();
+    not_empty.notify_all();
+}
+
+bool
+EntryQueue::failed(void)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    return !error.empty();
+}
+
+const std::string&
+EntryQueue::get_error(void)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    return error;
+}
+
+
+Walker::Walker(const fs::path& root, EntryQueue& queue, unsigned int jobs, bool grouped) :
+    root(root), q(&queue), jobs(jobs), grouped(grouped), metadata(false), known(NULL), busy(0), stopped(false)
+{
+}
+
+void
+Walker::collect_metadata(bool metadata)
+{
+    this->metadata = metadata;
+}
+
+void
+Walker::skip_unchanged(const std::map<std::string, KnownDirectory>* known)
+{
+    this->known = known;
+}
+
+void
+Walker::run(void)
+{
+    if(jobs > 1)
+        walk_parallel();
+    else
+        walk_serial();
+}
+
+void
+Walker::walk_serial(void)
+{
+    Entry entry;
+    fs::path current_path;
+    fs::recursive_directory_iterator end;
+
+    // Only directories read one by one come as listings and with metadata,
+    // the one worker of the parallel walk runs in this thread then
+    if(grouped || metadata)
+    {
+        pending.push_back(root.generic_string());
+
+        work();
+
+        if(!error.empty())
+            q->fail(error);
+        else
+            q->finish();
+
+        return;
+    }
+
+    entry.is_listing = false;
+    entry.is_unchanged = false;
+    entry.has_metadata = false;
+
+    try
+    {
+        for(fs::recursive_directory_iterator dir(root);
+            dir != end;
+            dir++)
+        {
+            current_path = dir->path();
+            entry.is_directory = fs::is_directory(current_path);
+
+            entry.directory = entry.is_directory ?
+                                current_path.generic_string() :
+                                current_path.parent_path().generic_string();
+
+            entry.file = entry.is_directory ?
+                           "NULL" :
+                           current_path.filename().generic_string();
+
+            // Stop if the inserter gave up
+            if(!q->push(entry))
+                return;
+        }
+    }
+    catch(fs::filesystem_error& e)
+    {
+        q->fail(e.what());
+        return;
+    }
+
+    q->finish();
+}
+
+// Name and type of an entry of a directory
+struct DirectoryEntry
+{
+    std::string name;
+    bool is_directory;
+    // Symbolic links to directories are directories, but are not
+    // followed, just as with recursive_directory_iterator
+    bool descend;
+    bool has_metadata;
+    boost::int64_t size;
+    boost::int64_t mtime;
+    char type;
+    DirectoryEntry(void) : is_directory(false), descend(false), has_metadata(false), size(0), mtime(0), type('o') {}
+};
+
+#ifdef _WIN32
+
+static bool
+read_directory(const fs::path& directory, std::vector<DirectoryEntry>& listing, std::string& message, bool metadata)
+{
+    DirectoryEntry de;
+    fs::directory_iterator end;
+
+    try
+    {
+        for(fs::directory_iterator dir(directory); dir != end; dir++)
+        {
+            de.name = dir->path().filename().generic_string();
+            de.is_directory = fs::is_directory(dir->path());
+            de.descend = de.is_directory && !fs::is_symlink(dir->path());
+            de.has_metadata = metadata;
+
+            if(metadata)
+            {
+                fs::file_status status = fs::symlink_status(dir->path());
+
+                de.type = fs::is_symlink(status) ? 'l' :
+                          fs::is_directory(status) ? 'd' :
+                          fs::is_regular_file(status) ? 'f' : 'o';
+                de.size = (de.type == 'f') ? fs::file_size(dir->path()) : 0;
+                de.mtime = fs::last_write_time(dir->path());
+            }
+
+            listing.push_back(de);
+        }
+    }
+    catch(fs::filesystem_error& e)
+    {
+        message = e.what();
+        return false;
+    }
+
+    return true;
+}
+
+#else
+
+static bool
+read_directory(const fs::path& directory, std::vector<DirectoryEntry>& listing, std::string& message, bool metadata)
+{
+    DirectoryEntry de;
+    struct dirent* d;
+    struct stat st;
+
+    DIR* dir = opendir(directory.c_str());
+
+    if(dir == NULL)
+    {
+        message = directory.generic_string() + ": " + strerror(errno);
+        return false;
+    }
+
+    while((d = readdir(dir)) != NULL)
+    {
+        if(strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            continue;
+
+        de.name = d->d_name;
+        de.has_metadata = false;
+
+        // Metadata costs one stat() per entry, which also tells the type
+        if(metadata && fstatat(dirfd(dir), d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        {
+            de.has_metadata = true;
+            de.size = st.st_size;
+            de.mtime = st.st_mtime;
+            de.type = S_ISREG(st.st_mode) ? 'f' :
+                      S_ISDIR(st.st_mode) ? 'd' :
+                      S_ISLNK(st.st_mode) ? 'l' : 'o';
+
+            if(!S_ISLNK(st.st_mode))
+            {
+                de.is_directory = de.descend = S_ISDIR(st.st_mode);
+                listing.push_back(de);
+                continue;
+            }
+        }
+
+#ifdef _DIRENT_HAVE_D_TYPE
+        // Most file systems tell the type without an extra stat()
+        if(d->d_type != DT_LNK && d->d_type != DT_UNKNOWN)
+        {
+            de.is_directory = de.descend = (d->d_type == DT_DIR);
+            listing.push_back(de);
+            continue;
+        }
+#endif
+
+        std::string path = (directory / de.name).string();
+
+        de.descend = (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+        de.is_directory = de.descend || (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+
+        listing.push_back(de);
+    }
+
+    closedir(dir);
+
+    return true;
+}
+
+#endif /* _WIN32 */
+
+void
+Walker::walk_parallel(void)
+{
+    boost::thread_group workers;
+
+    pending.push_back(root.generic_string());
+
+    for(unsigned int i = 0; i < jobs; i++)
+        workers.add_thread(new boost::thread(&Walker::work, this));
+
+    workers.join_all();
+
+    if(!error.empty())
+        q->fail(error);
+    else
+        q->finish();
+}
+
+void
+Walker::work(void)
+{
+    std::string directory;
+    std::string message;
+
+    while(take(directory))
+    {
+        if(!scan(directory, message))
+            abort(message);
+
+        boost::mutex::scoped_lock lock(mutex);
+
+        // Last busy worker with nothing left wakes up the others
+        busy--;
+        if(busy == 0 && pending.empty())
+            work_available.notify_all();
+    }
+}
+
+bool
+Walker::take(std::string& directory)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    // Wait while other workers may still find subdirectories
+    while(pending.empty() && busy > 0 && !stopped)
+        work_available.wait(lock);
+
+    if(stopped || pending.empty())
+        return false;
+
+    // Take the newest directory, this keeps the walk depth first
+    directory = pending.back();
+    pending.pop_back();
+    busy++;
+
+    return true;
+}
+
+void
+Walker::give(std::vector<std::string>& directories)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    foreach(std::string& directory, directories)
+    {
+        pending.push_back(directory);
+        work_available.notify_one();
+    }
+}
+
+void
+Walker::abort(const std::string& message)
+{
+    boost::mutex::scoped_lock lock(mutex);
+
+    stopped = true;
+
+    if(error.empty())
+        error = message;
+
+    work_available.notify_all();
+}
+
+bool
+Walker::scan(const std::string& directory, std::string& message)
+{
+    Entry entry;
+    fs::path directory_path(directory);
+    std::string parent;
+    std::vector<DirectoryEntry> listing;
+    std::vector<Entry> group;
+    std::vector<std::string> subdirectories;
+
+    // The time is taken before reading, so that later changes show
+    boost::system::error_code ec;
+    std::time_t mtime = metadata ? fs::last_write_time(directory_path, ec) : 0;
+
+    // Leave out directories unchanged since the earlier walk
+    if(known != NULL && metadata && !ec)
+    {
+        std::map<std::string, KnownDirectory>::const_iterator it = known->find(directory);
+
+        if(it != known->end() && mtime == it->second.mtime)
+        {
+            Entry head;
+            head.directory = directory;
+            head.is_directory = true;
+            head.is_listing = true;
+            head.is_unchanged = true;
+            head.has_metadata = false;
+
+            if(!q->push(head))
+            {
+                message.clear();
+                return false;
+            }
+
+            foreach(const std::string& name, it->second.subdirectories)
+                subdirectories.push_back((directory_path / name).generic_string());
+
+            give(subdirectories);
+
+            return true;
+        }
+    }
+
+    if(!read_directory(directory_path, listing, message, metadata))
+        return false;
+
+    entry.is_listing = false;
+    entry.is_unchanged = false;
+
+    // Listings start with the directory itself
+    if(grouped)
+    {
+        Entry head;
+        head.directory = directory;
+        head.is_directory = true;
+        head.is_listing = true;
+        head.is_unchanged = false;
+        head.has_metadata = metadata && !ec;
+        head.mtime = mtime;
+        head.type = 'd';
+
+        group.reserve(listing.size() + 1);
+        group.push_back(head);
+    }
+
+    foreach(DirectoryEntry& de, listing)
+    {
+        fs::path current_path = directory_path / de.name;
+
+        entry.is_directory = de.is_directory;
+        entry.has_metadata = de.has_metadata;
+        entry.size = de.size;
+        entry.mtime = de.mtime;
+        entry.type = de.type;
+
+        if(entry.is_directory)
+        {
+            entry.directory = current_path.generic_string();
+            entry.file = "NULL";
+
+            if(de.descend)
+                subdirectories.push_back(entry.directory);
+        }
+        else
+        {
+            // All files of this directory share the same parent
+            if(parent.empty())
+                parent = current_path.parent_path().generic_string();
+
+            entry.directory = parent;
+            entry.file = de.name;
+        }
+
+        if(grouped)
+        {
+            group.push_back(entry);
+        }
+        else if(!q->push(entry))
+        {
+            // Stop if the inserter gave up
+            message.clear();
+            return false;
+        }
+    }
+
+    if(grouped && !q->push_all(group))
+    {
+        message.clear();
+        return false;
+    }
+
+    give(subdirectories);
+
+    return true;
+}
@@ -0,0 +1,138 @@
+/**
+ *  walk.hpp
+ *
+ *  Directory walking include part of Disc Data Base.
+ *
+ *  Copyright (c) 2010-2011 Wincent Balin
+ *
+ *  Based upon ddb.pl, created years before and serving faithfully until today.
+ *
+ *  Uses SQLite database version 3.
+ *
+ *  Published under MIT license. See LICENSE file for further information.
+ */
+
+#ifndef WALK_HPP
+#define WALK_HPP
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+
+//  Deprecated features not wanted
+#define BOOST_FILESYSTEM_NO_DEPRECATED
+
+#include <boost/filesystem.hpp>
+
+
+// One row of the catalog as produced by the walker
+struct Entry
+{
+    std::string directory;
+    std::string file;
+    bool is_directory;
+    // Heads the complete listing of the directory, see Walker
+    bool is_listing;
+    // Heads a listing left out because the directory did not change
+    bool is_unchanged;
+    // Size, modification time and type ('f', 'd', 'l' or 'o'), if collected
+    bool has_metadata;
+    boost::int64_t size;
+    boost::int64_t mtime;
+    char type;
+    // Digest of the contents of regular files, if hashed
+    bool has_hash;
+    boost::uint64_t hash;
+    Entry(void) : is_directory(false), is_listing(false), is_unchanged(false), has_metadata(false), size(0), mtime(0), type('o'),
+                  has_hash(false), hash(0) {}
+};
+
+// What the walker knows about a directory from an earlier walk
+struct KnownDirectory
+{
+    // -1 if not known
+    boost::int64_t mtime;
+    std::vector<std::string> subdirectories;
+    KnownDirectory(void) : mtime(-1) {}
+};
+
+// Bounded queue between the walker and the database inserter
+class EntryQueue
+{
+public:
+    EntryQueue(size_t capacity = 65536);
+    // Blocks while the queue is full; returns false if the queue was closed
+    bool push(Entry& entry);
+    // Pushes all entries at once, so that they stay together
+    bool push_all(std::vector<Entry>& group);
+    // Blocks until entries are available; returns 0 if closed and drained
+    // or cancelled
+    size_t pop(std::vector<Entry>& batch, size_t max_entries);
+    // Producer is done; consumer will drain the rest
+    void finish(void);
+    // Producer failed; consumer will see the error after draining
+    void fail(const std::string& message);
+    // Consumer gave up; producer stops at its next push, consumers at
+    // their next pop
+    void cancel(void);
+    bool failed(void);
+    const std::string& get_error(void);
+private:
+    boost::mutex mutex;
+    boost::condition_variable not_full;
+    boost::condition_variable not_empty;
+    std::deque<Entry> entries;
+    size_t capacity;
+    bool finished;
+    bool cancelled;
+    std::string error;
+};
+
+/*
+ * Recursive directory walker, meant to run in its own thread.
+ *
+ * A grouped walker emits every directory as a listing: an entry with
+ * is_listing set and the directory's path, followed by all its files and
+ * subdirectories. Listings of subdirectories follow the listing of their
+ * parent.
+ *
+ * A walker collecting metadata stats every entry. Given the directories of
+ * an earlier walk, it does not read directories whose modification time is
+ * unchanged; their listing is just a head with is_unchanged set, and their
+ * known subdirectories are walked as usual.
+ */
+class Walker
+{
+public:
+    Walker(const boost::filesystem::path& root, EntryQueue& queue, unsigned int jobs = 1, bool grouped = false);
+    void collect_metadata(bool metadata);
+    void skip_unchanged(const std::map<std::string, KnownDirectory>* known);
+    void run(void);
+private:
+    void walk_serial(void);
+    void walk_parallel(void);
+    void work(void);
+    bool scan(const std::string& directory, std::string& error);
+    bool take(std::string& directory);
+    void give(std::vector<std::string>& directories);
+    void abort(const std::string& message);
+    boost::filesystem::path root;
+    EntryQueue* q;
+    unsigned int jobs;
+    bool grouped;
+    bool metadata;
+    const std::map<std::string, KnownDirectory>* known;
+    // Parallel walking: directories not yet scanned, shared by all workers
+    boost::mutex mutex;
+    boost::condition_variable work_available;
+    std::deque<std::string> pending;
+    unsigned int busy;
+    bool stopped;
+    std::string error;
+};
+
+#endif /* WALK_HPP */